@@ -0,0 +1,9 @@
+QT += gui
+CONFIG += console
+CONFIG -= app_bundle
+
+SOURCES += \
+        ../compositekernel.cpp \
+        main.cpp
+
+HEADERS += ../compositekernel.h
@@ -0,0 +1,253 @@
+#include <QGuiApplication>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QLinearGradient>
+#include <QPainter>
+#include <QDebug>
+#include <random>
+#include "../compositekernel.h"
+
+using namespace qtwrapper;
+
+// the gradient path of OpacityImage::paint before the single pass kernel
+static void compositePainter(QImage &target, const QImage &image, const QGradient &gradient) {
+    QImage opacityMask(target.size(), QImage::Format_Alpha8);
+    QPainter oPainter(&opacityMask);
+    QImage resultImage(target.size(), QImage::Format_ARGB32_Premultiplied);
+    QPainter iPainter(&resultImage);
+
+    oPainter.setCompositionMode(QPainter::CompositionMode_Source);
+    oPainter.fillRect(opacityMask.rect(), gradient);
+    oPainter.end();
+
+    iPainter.setCompositionMode(QPainter::CompositionMode_Source);
+    iPainter.fillRect(resultImage.rect(), Qt::transparent);
+    iPainter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    iPainter.drawImage(0, 0, opacityMask);
+    iPainter.setCompositionMode(QPainter::CompositionMode_SourceAtop);
+    iPainter.drawImage(0, 0, image);
+    iPainter.end();
+
+    QPainter painter(&target);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(0, 0, resultImage);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceAtop);
+    painter.fillRect(target.rect(), gradient);
+    painter.end();
+}
+
+// run fnc for about 200 ms, return the time of one call in microseconds
+template <typename Fnc>
+static double measure(Fnc fnc) {
+    QElapsedTimer timer;
+    int iterations = 0;
+    timer.start();
+    while (timer.elapsed() < 200) {
+        fnc();
+        iterations++;
+    }
+    return timer.nsecsElapsed() / 1000.0 / iterations;
+}
+
+// deterministic translucent premultiplied pattern, so the kernels see every alpha
+static QImage patternImage(const QSize &size) {
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < size.height(); y++) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < size.width(); x++) line[x] = qPremultiply(qRgba(x & 0xff, y & 0xff, (x + y) & 0xff, (x * 7 + y * 13) & 0xff));
+    }
+    return image;
+}
+
+static QLinearGradient benchGradient(const QSize &size) {
+    QLinearGradient gradient(QPointF(0, 0), QPointF(0, size.height()));
+    gradient.setColorAt(0, QColor(0, 0, 0, 0));
+    gradient.setColorAt(1, QColor(20, 40, 80, 200));
+    return gradient;
+}
+
+// mask and tint are cached by OpacityImage, only the composition runs on a source change
+static void rasterizeGradient(const QSize &size, const QGradient &gradient, QImage &mask, QImage &tint) {
+    mask = QImage(size, QImage::Format_Alpha8);
+    tint = QImage(size, QImage::Format_ARGB32_Premultiplied);
+    mask.fill(0);
+    tint.fill(Qt::transparent);
+    QPainter mPainter(&mask);
+    mPainter.setCompositionMode(QPainter::CompositionMode_Source);
+    mPainter.fillRect(mask.rect(), gradient);
+    mPainter.end();
+    QPainter tPainter(&tint);
+    tPainter.setCompositionMode(QPainter::CompositionMode_Source);
+    tPainter.fillRect(tint.rect(), gradient);
+    tPainter.end();
+}
+
+// largest difference of a channel between two images of the same size and format, and the pixels which differ
+static int maxChannelDiff(const QImage &a, const QImage &b, int *pixels) {
+    int maxDiff = 0;
+    *pixels = 0;
+    for (int y = 0; y < a.height(); y++) {
+        const QRgb *la = reinterpret_cast<const QRgb *>(a.constScanLine(y));
+        const QRgb *lb = reinterpret_cast<const QRgb *>(b.constScanLine(y));
+        for (int x = 0; x < a.width(); x++) {
+            if (la[x] == lb[x]) continue;
+            (*pixels)++;
+            for (int shift = 0; shift < 32; shift += 8) {
+                maxDiff = qMax(maxDiff, qAbs(int((la[x] >> shift) & 0xff) - int((lb[x] >> shift) & 0xff)));
+            }
+        }
+    }
+    return maxDiff;
+}
+
+// the same composition with QPainter from a mask and a tint which are not related, for the random cases
+static void compositePainterLayers(QImage &target, const QImage &image, const QImage &mask, const QImage &tint) {
+    target.fill(Qt::transparent);
+    QPainter painter(&target);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(0, 0, mask);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceAtop);
+    painter.drawImage(0, 0, image);
+    painter.drawImage(0, 0, tint);
+    painter.end();
+}
+
+// seeded random premultiplied image, tint and mask; a quarter of the mask is opaque and a quarter empty
+static void randomInputs(const QSize &size, quint32 seed, QImage &image, QImage &mask, QImage &tint) {
+    std::mt19937 random(seed);
+    auto premultiplied = [&random]() {
+        const quint32 alpha = random() & 0xff;
+        return qRgba(int(random() % (alpha + 1)), int(random() % (alpha + 1)), int(random() % (alpha + 1)), int(alpha));
+    };
+    image = QImage(size, QImage::Format_ARGB32_Premultiplied);
+    tint = QImage(size, QImage::Format_ARGB32_Premultiplied);
+    mask = QImage(size, QImage::Format_Alpha8);
+    for (int y = 0; y < size.height(); y++) {
+        QRgb *iLine = reinterpret_cast<QRgb *>(image.scanLine(y));
+        QRgb *tLine = reinterpret_cast<QRgb *>(tint.scanLine(y));
+        uchar *mLine = mask.scanLine(y);
+        for (int x = 0; x < size.width(); x++) {
+            iLine[x] = premultiplied();
+            tLine[x] = premultiplied();
+            const quint32 kind = random() & 3;
+            mLine[x] = kind == 0 ? 0 : kind == 1 ? 255 : uchar(random());
+        }
+    }
+}
+
+// QPainter rounds its blends differently, the kernels must stay within this of it
+static const int sPainterTolerance = 3;
+
+// compare every kernel with the scalar one (exactly) and the scalar one with the QPainter result
+// (within sPainterTolerance), for the whole image, a sub rect and the coverage pass
+static bool verifyCase(const QString &name, const QImage &image, const QImage &mask, const QImage &tint, const QImage &painterResult) {
+    const char *kernels[] = {"sse2", "avx2"};
+    const QSize size = image.size();
+    const QRect part(size.width() / 3, size.height() / 3, qMax(1, size.width() / 2), qMax(1, size.height() / 2));
+    bool ok = true;
+
+    setCompositeKernel("scalar");
+    QImage reference(size, QImage::Format_ARGB32_Premultiplied);
+    compositeMaskedTint(reference, image, mask, tint);
+    QImage referencePart = image.copy();
+    compositeMaskedTint(referencePart, image, mask, tint, part);
+    QImage referenceCoverage = image.copy();
+    multiplyCoverage(referenceCoverage, mask);
+
+    QImage painterCoverage = image.copy();
+    QPainter cPainter(&painterCoverage);
+    cPainter.setCompositionMode(QPainter::CompositionMode_DestinationIn);
+    cPainter.drawImage(0, 0, mask);
+    cPainter.end();
+
+    int pixels = 0;
+    int diff = maxChannelDiff(reference, painterResult, &pixels);
+    bool match = diff <= sPainterTolerance;
+    ok = ok && match;
+    qInfo().noquote() << QString("%1 scalar vs qpainter: composite max diff %2 (%3 pixels) %4").arg(name).arg(diff).arg(pixels).arg(match ? "ok" : "FAILED");
+    diff = maxChannelDiff(referenceCoverage, painterCoverage, &pixels);
+    match = diff <= sPainterTolerance;
+    ok = ok && match;
+    qInfo().noquote() << QString("%1 scalar vs qpainter: coverage max diff %2 (%3 pixels) %4").arg(name).arg(diff).arg(pixels).arg(match ? "ok" : "FAILED");
+
+    for (const char *kernel : kernels) {
+        if (!setCompositeKernel(kernel)) {
+            qInfo().noquote() << QString("%1 %2 not supported by this CPU, skipped").arg(name).arg(kernel);
+            continue;
+        }
+        QImage result(size, QImage::Format_ARGB32_Premultiplied);
+        compositeMaskedTint(result, image, mask, tint);
+        QImage resultPart = image.copy();
+        compositeMaskedTint(resultPart, image, mask, tint, part);
+        QImage resultCoverage = image.copy();
+        multiplyCoverage(resultCoverage, mask);
+
+        match = result == reference && resultPart == referencePart && resultCoverage == referenceCoverage;
+        ok = ok && match;
+        qInfo().noquote() << QString("%1 %2 vs scalar: %3").arg(name).arg(kernel).arg(match ? "identical" : "FAILED");
+    }
+    return ok;
+}
+
+// verify the gradient OpacityImage uses and seeded random masks and tints, on odd sizes so the SIMD tails run too,
+// return false on a mismatch
+static bool verify() {
+    const QSize sizes[] = {QSize(1, 1), QSize(7, 3), QSize(67, 33), QSize(513, 257)};
+    static const int sRandomSeeds = 8;
+    bool ok = true;
+
+    for (const QSize &size : sizes) {
+        const QString name = QString("%1x%2").arg(size.width()).arg(size.height());
+        const QImage image = patternImage(size);
+        const QLinearGradient gradient = benchGradient(size);
+        QImage mask, tint;
+        rasterizeGradient(size, gradient, mask, tint);
+        QImage painterResult(size, QImage::Format_ARGB32_Premultiplied);
+        compositePainter(painterResult, image, gradient);
+        ok = verifyCase(name + " gradient", image, mask, tint, painterResult) && ok;
+
+        for (quint32 seed = 1; seed <= sRandomSeeds; seed++) {
+            QImage randomImage;
+            randomInputs(size, seed, randomImage, mask, tint);
+            compositePainterLayers(painterResult, randomImage, mask, tint);
+            ok = verifyCase(QString("%1 random seed %2").arg(name).arg(seed), randomImage, mask, tint, painterResult) && ok;
+        }
+    }
+    return ok;
+}
+
+// bench            time QPainter and every kernel
+// bench --verify   compare the output of every kernel with the scalar one and with QPainter, for the gradient and
+//                  random masks and tints, exit 1 on a mismatch
+int main(int argc, char *argv[]) {
+    QGuiApplication app(argc, argv);
+
+    if (app.arguments().contains("--verify")) return verify() ? 0 : 1;
+
+    const QSize sizes[] = {QSize(64, 64), QSize(128, 128), QSize(512, 512), QSize(1920, 1080)};
+    const char *kernels[] = {"scalar", "sse2", "avx2"};
+
+    for (const QSize &size : sizes) {
+        const QImage image = patternImage(size);
+        const QLinearGradient gradient = benchGradient(size);
+        QImage mask, tint;
+        rasterizeGradient(size, gradient, mask, tint);
+
+        QImage target(size, QImage::Format_ARGB32_Premultiplied);
+        double painterUs = measure([&]() { compositePainter(target, image, gradient); });
+        qInfo().noquote() << QString("%1x%2 qpainter %3 us").arg(size.width()).arg(size.height()).arg(painterUs, 0, 'f', 1);
+
+        QImage result(size, QImage::Format_ARGB32_Premultiplied);
+        for (const char *kernel : kernels) {
+            if (!setCompositeKernel(kernel)) continue;
+            double kernelUs = measure([&]() { compositeMaskedTint(result, image, mask, tint); });
+            qInfo().noquote() << QString("%1x%2 %3 %4 us (x%5)")
+                                     .arg(size.width())
+                                     .arg(size.height())
+                                     .arg(kernel)
+                                     .arg(kernelUs, 0, 'f', 1)
+                                     .arg(painterUs / kernelUs, 0, 'f', 1);
+        }
+    }
+    return 0;
+}
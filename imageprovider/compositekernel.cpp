@@ -0,0 +1,321 @@
+/**
+ * @file compositekernel.cpp
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "compositekernel.h"
+#include <atomic>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define COMPOSITE_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define COMPOSITE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+namespace qtwrapper
+{
+    /* One row: "imageWidth" first pixels come from image, the rest of the row has no image under the tint */
+    typedef void (*CompositeRowFunc)(quint32 *dst, const quint32 *image, int imageWidth, const uchar *mask, const quint32 *tint, int width);
+
+    /* One row of dst multiplied by the coverage mask */
+    typedef void (*CoverageRowFunc)(quint32 *dst, const uchar *coverage, int width);
+
+    /**
+     * @fn byteMul
+     * @brief Multiply the 4 channels of a pixel by a / 255, rounded to nearest like the SIMD kernels
+     */
+    static inline quint32 byteMul(quint32 x, quint32 a) {
+        quint32 t = (x & 0xff00ff) * a + 0x800080;
+        t = ((t + ((t >> 8) & 0xff00ff)) >> 8) & 0xff00ff;
+        x = ((x >> 8) & 0xff00ff) * a + 0x800080;
+        x = (x + ((x >> 8) & 0xff00ff)) & 0xff00ff00;
+        return x | t;
+    }
+
+    static inline quint32 compositePixel(quint32 image, uchar mask, quint32 tint) {
+        quint32 over = tint + byteMul(image, 255 - (tint >> 24));
+        return (byteMul(over, mask) & 0x00ffffff) | (static_cast<quint32>(mask) << 24);
+    }
+
+    static void compositeRowScalar(quint32 *dst, const quint32 *image, int imageWidth, const uchar *mask, const quint32 *tint, int width) {
+        int x = 0;
+        for (; x < imageWidth; x++) dst[x] = compositePixel(image[x], mask[x], tint[x]);
+        for (; x < width; x++) dst[x] = compositePixel(0, mask[x], tint[x]);
+    }
+
+    static void coverageRowScalar(quint32 *dst, const uchar *coverage, int width) {
+        for (int x = 0; x < width; x++) {
+            if (coverage[x] != 255) dst[x] = byteMul(dst[x], coverage[x]);
+        }
+    }
+
+#ifdef COMPOSITE_SSE2
+    /* x * a / 255 on 16 bit lanes, rounded like byteMul */
+    static inline __m128i mul255Sse2(__m128i x, __m128i a) {
+        __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, a), _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+
+    /* Two pixels widened to 16 bit lanes */
+    static inline __m128i compositeHalfSse2(__m128i image, __m128i tint, __m128i mask) {
+        const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+        __m128i tintAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(tint, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+        __m128i over = _mm_add_epi16(tint, mul255Sse2(image, _mm_sub_epi16(_mm_set1_epi16(255), tintAlpha)));
+        __m128i out = mul255Sse2(over, mask);
+        return _mm_or_si128(_mm_andnot_si128(alphaLanes, out), _mm_and_si128(alphaLanes, mask));
+    }
+
+    /* m0 m1 m2 m3 -> each mask byte repeated for the 4 channels of its pixel */
+    static inline __m128i expandMask4Sse2(const uchar *mask) {
+        int m;
+        memcpy(&m, mask, sizeof(m));
+        __m128i masks = _mm_cvtsi32_si128(m);
+        masks = _mm_unpacklo_epi8(masks, masks);
+        return _mm_unpacklo_epi16(masks, masks);
+    }
+
+    static inline __m128i composite4Sse2(__m128i image, __m128i tint, const uchar *mask) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i masks = expandMask4Sse2(mask);
+
+        __m128i lo = compositeHalfSse2(_mm_unpacklo_epi8(image, zero), _mm_unpacklo_epi8(tint, zero), _mm_unpacklo_epi8(masks, zero));
+        __m128i hi = compositeHalfSse2(_mm_unpackhi_epi8(image, zero), _mm_unpackhi_epi8(tint, zero), _mm_unpackhi_epi8(masks, zero));
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    static void compositeRowSse2(quint32 *dst, const quint32 *image, int imageWidth, const uchar *mask, const quint32 *tint, int width) {
+        const __m128i zero = _mm_setzero_si128();
+        int x = 0;
+        for (; x + 4 <= imageWidth; x += 4) {
+            __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(image + x));
+            __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tint + x));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), composite4Sse2(in, t, mask + x));
+        }
+        for (; x < imageWidth; x++) dst[x] = compositePixel(image[x], mask[x], tint[x]);
+
+        for (; x + 4 <= width; x += 4) {
+            __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tint + x));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), composite4Sse2(zero, t, mask + x));
+        }
+        for (; x < width; x++) dst[x] = compositePixel(0, mask[x], tint[x]);
+    }
+
+    static void coverageRowSse2(quint32 *dst, const uchar *coverage, int width) {
+        const __m128i zero = _mm_setzero_si128();
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + x));
+            __m128i masks = expandMask4Sse2(coverage + x);
+            __m128i lo = mul255Sse2(_mm_unpacklo_epi8(in, zero), _mm_unpacklo_epi8(masks, zero));
+            __m128i hi = mul255Sse2(_mm_unpackhi_epi8(in, zero), _mm_unpackhi_epi8(masks, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_packus_epi16(lo, hi));
+        }
+        coverageRowScalar(dst + x, coverage + x, width - x);
+    }
+#endif
+
+#ifdef COMPOSITE_AVX2
+    __attribute__((target("avx2"))) static inline __m256i mul255Avx2(__m256i x, __m256i a) {
+        __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, a), _mm256_set1_epi16(128));
+        return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+    }
+
+    __attribute__((target("avx2"))) static inline __m256i compositeHalfAvx2(__m256i image, __m256i tint, __m256i mask) {
+        const __m256i alphaLanes = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+        __m256i tintAlpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(tint, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+        __m256i over = _mm256_add_epi16(tint, mul255Avx2(image, _mm256_sub_epi16(_mm256_set1_epi16(255), tintAlpha)));
+        __m256i out = mul255Avx2(over, mask);
+        return _mm256_or_si256(_mm256_andnot_si256(alphaLanes, out), _mm256_and_si256(alphaLanes, mask));
+    }
+
+    /* Unpacking works per 128 bit lane: masks of pixels 0-3 go to the low lane, 4-7 to the high one */
+    __attribute__((target("avx2"))) static inline __m256i expandMask8Avx2(const uchar *mask) {
+        __m128i masks = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(mask));
+        masks = _mm_unpacklo_epi8(masks, masks);
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(masks, masks)), _mm_unpackhi_epi16(masks, masks), 1);
+    }
+
+    __attribute__((target("avx2"))) static inline __m256i composite8Avx2(__m256i image, __m256i tint, const uchar *mask) {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i wide = expandMask8Avx2(mask);
+
+        __m256i lo = compositeHalfAvx2(_mm256_unpacklo_epi8(image, zero), _mm256_unpacklo_epi8(tint, zero), _mm256_unpacklo_epi8(wide, zero));
+        __m256i hi = compositeHalfAvx2(_mm256_unpackhi_epi8(image, zero), _mm256_unpackhi_epi8(tint, zero), _mm256_unpackhi_epi8(wide, zero));
+        return _mm256_packus_epi16(lo, hi);
+    }
+
+    __attribute__((target("avx2"))) static void compositeRowAvx2(quint32 *dst, const quint32 *image, int imageWidth, const uchar *mask, const quint32 *tint, int width) {
+        const __m256i zero = _mm256_setzero_si256();
+        int x = 0;
+        for (; x + 8 <= imageWidth; x += 8) {
+            __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(image + x));
+            __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tint + x));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), composite8Avx2(in, t, mask + x));
+        }
+        for (; x < imageWidth; x++) dst[x] = compositePixel(image[x], mask[x], tint[x]);
+
+        for (; x + 8 <= width; x += 8) {
+            __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tint + x));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), composite8Avx2(zero, t, mask + x));
+        }
+        for (; x < width; x++) dst[x] = compositePixel(0, mask[x], tint[x]);
+    }
+
+    __attribute__((target("avx2"))) static void coverageRowAvx2(quint32 *dst, const uchar *coverage, int width) {
+        const __m256i zero = _mm256_setzero_si256();
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + x));
+            __m256i wide = expandMask8Avx2(coverage + x);
+            __m256i lo = mul255Avx2(_mm256_unpacklo_epi8(in, zero), _mm256_unpacklo_epi8(wide, zero));
+            __m256i hi = mul255Avx2(_mm256_unpackhi_epi8(in, zero), _mm256_unpackhi_epi8(wide, zero));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), _mm256_packus_epi16(lo, hi));
+        }
+        coverageRowScalar(dst + x, coverage + x, width - x);
+    }
+#endif
+
+    static bool cpuHasAvx2() {
+#ifdef COMPOSITE_AVX2
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    typedef struct {
+        const char *name;
+        CompositeRowFunc func;
+        CoverageRowFunc coverage;
+    } CompositeKernel;
+
+    static const CompositeKernel sKernels[] = {
+#ifdef COMPOSITE_AVX2
+        {"avx2", compositeRowAvx2, coverageRowAvx2},
+#endif
+#ifdef COMPOSITE_SSE2
+        {"sse2", compositeRowSse2, coverageRowSse2},
+#endif
+        {"scalar", compositeRowScalar, coverageRowScalar},
+    };
+
+    static bool kernelSupported(const CompositeKernel &kernel) {
+        if (strcmp(kernel.name, "avx2") == 0) return cpuHasAvx2();
+        return true;
+    }
+
+    /**
+     * @fn matchesScalar
+     * @brief Run a kernel and the scalar one on pseudo random rows (every alpha, widths covering the SIMD tails,
+     * rows partly without image) and compare the pixels. A SIMD kernel only becomes the default if they are identical.
+     */
+    static bool matchesScalar(const CompositeKernel &kernel) {
+        static const int sWidth = 67;
+        quint32 seed = 0x2545f491;
+        auto next = [&seed]() {
+            seed = seed * 1664525 + 1013904223;
+            return seed >> 8;
+        };
+        auto premultiplied = [&next]() {
+            const quint32 a = next() & 0xff;
+            return (a << 24) | ((next() % (a + 1)) << 16) | ((next() % (a + 1)) << 8) | (next() % (a + 1));
+        };
+
+        quint32 image[sWidth], tint[sWidth], expected[sWidth], result[sWidth];
+        uchar mask[sWidth];
+        for (int width = 1; width <= sWidth; width += 3) {
+            for (int x = 0; x < width; x++) {
+                image[x] = premultiplied();
+                tint[x] = premultiplied();
+                mask[x] = (x % 5 == 0) ? 255 : static_cast<uchar>(next());
+            }
+            const int imageWidth = width * 2 / 3;
+            compositeRowScalar(expected, image, imageWidth, mask, tint, width);
+            kernel.func(result, image, imageWidth, mask, tint, width);
+            if (memcmp(expected, result, width * sizeof(quint32)) != 0) return false;
+
+            memcpy(expected, image, width * sizeof(quint32));
+            memcpy(result, image, width * sizeof(quint32));
+            coverageRowScalar(expected, mask, width);
+            kernel.coverage(result, mask, width);
+            if (memcmp(expected, result, width * sizeof(quint32)) != 0) return false;
+        }
+        return true;
+    }
+
+    /**
+     * @fn selectedKernel
+     * @brief Best kernel for this CPU which gives the same pixels as the scalar one, chosen on first use
+     */
+    static std::atomic<const CompositeKernel *> &selectedKernel() {
+        static std::atomic<const CompositeKernel *> kernel([]() {
+            for (const CompositeKernel &k : sKernels) {
+                if (kernelSupported(k) && (k.func == compositeRowScalar || matchesScalar(k))) return &k;
+            }
+            return &sKernels[0];
+        }());
+        return kernel;
+    }
+
+    bool compositeMaskedTint(QImage &dst, const QImage &image, const QImage &mask, const QImage &tint, const QRect &rect) {
+        const QSize size = dst.size();
+        if (dst.format() != QImage::Format_ARGB32_Premultiplied || mask.format() != QImage::Format_Alpha8 ||
+            tint.format() != QImage::Format_ARGB32_Premultiplied || mask.size() != size || tint.size() != size) {
+            return false;
+        }
+        if (!image.isNull() && image.format() != QImage::Format_ARGB32_Premultiplied && image.format() != QImage::Format_RGB32) {
+            return false;
+        }
+
+        CompositeRowFunc func = selectedKernel().load()->func;
+        const QRect area = rect.isNull() ? dst.rect() : rect.intersected(dst.rect());
+        const int imageWidth = image.isNull() ? 0 : qMin(image.width(), size.width());
+        const int imageHeight = image.isNull() ? 0 : qMin(image.height(), size.height());
+        const int inWidth = qBound(0, imageWidth - area.left(), area.width());
+        for (int y = area.top(); y <= area.bottom(); y++) {
+            const quint32 *in = (y < imageHeight && inWidth > 0) ? reinterpret_cast<const quint32 *>(image.constScanLine(y)) + area.left() : NULL;
+            func(reinterpret_cast<quint32 *>(dst.scanLine(y)) + area.left(), in, in ? inWidth : 0, mask.constScanLine(y) + area.left(),
+                 reinterpret_cast<const quint32 *>(tint.constScanLine(y)) + area.left(), area.width());
+        }
+        return true;
+    }
+
+    bool multiplyCoverage(QImage &dst, const QImage &coverage, const QRect &rect) {
+        if (dst.format() != QImage::Format_ARGB32_Premultiplied || coverage.format() != QImage::Format_Alpha8 ||
+            coverage.size() != dst.size()) {
+            return false;
+        }
+
+        CoverageRowFunc func = selectedKernel().load()->coverage;
+        const QRect area = rect.isNull() ? dst.rect() : rect.intersected(dst.rect());
+        for (int y = area.top(); y <= area.bottom(); y++) {
+            func(reinterpret_cast<quint32 *>(dst.scanLine(y)) + area.left(), coverage.constScanLine(y) + area.left(), area.width());
+        }
+        return true;
+    }
+
+    const char *compositeKernelName() {
+        return selectedKernel().load()->name;
+    }
+
+    bool setCompositeKernel(const char *name) {
+        for (const CompositeKernel &k : sKernels) {
+            if (strcmp(k.name, name) != 0) continue;
+            if (!kernelSupported(k)) return false;
+            selectedKernel().store(&k);
+            return true;
+        }
+        return false;
+    }
+} // namespace qtwrapper
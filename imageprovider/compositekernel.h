@@ -0,0 +1,60 @@
+/**
+ * @file compositekernel.h
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef __COMPOSITEKERNEL_H__
+#define __COMPOSITEKERNEL_H__
+
+#include <QImage>
+
+namespace qtwrapper
+{
+    /**
+     * @fn compositeMaskedTint
+     * @brief Single pass equivalent of the QPainter sequence used by OpacityImage for gradients:
+     * clear dst, draw the mask (SourceOver), the image (SourceAtop) then the tint (SourceAtop).
+     * Per pixel: dst.rgb = mask * (tint over image).rgb, dst.alpha = mask.
+     * The image is drawn at (0, 0), the part of dst it does not cover only gets the tint.
+     *
+     * @param dst       Format_ARGB32_Premultiplied, the size of mask and tint
+     * @param image     Format_ARGB32_Premultiplied or Format_RGB32
+     * @param mask      Format_Alpha8
+     * @param tint      Format_ARGB32_Premultiplied
+     * @param rect      Part of dst to compose, all of it if null
+     * @return true     false if a format or a size does not match (dst is not touched)
+     */
+    bool compositeMaskedTint(QImage &dst, const QImage &image, const QImage &mask, const QImage &tint, const QRect &rect = QRect());
+
+    /**
+     * @fn multiplyCoverage
+     * @brief Multiply every channel of dst by the coverage of its pixel: an antialiased clip applied after drawing
+     *
+     * @param dst       Format_ARGB32_Premultiplied
+     * @param coverage  Format_Alpha8, the size of dst
+     * @param rect      Part of dst to multiply, all of it if null
+     * @return true     false if a format or the size does not match (dst is not touched)
+     */
+    bool multiplyCoverage(QImage &dst, const QImage &coverage, const QRect &rect = QRect());
+
+    /**
+     * @fn compositeKernelName
+     * @brief Kernel selected for this CPU: "avx2", "sse2" or "scalar"
+     */
+    const char *compositeKernelName();
+
+    /**
+     * @fn setCompositeKernel
+     * @brief Force a kernel (for benchmarks), a kernel this CPU does not support is ignored
+     *
+     * @return true     the kernel is selected
+     */
+    bool setCompositeKernel(const char *name);
+} // namespace qtwrapper
+#endif // __COMPOSITEKERNEL_H__
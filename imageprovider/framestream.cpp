@@ -0,0 +1,152 @@
+/**
+ * @file framestream.cpp
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "framestream.h"
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+namespace qtwrapper
+{
+    /* Cleanup info of a frame, the stream may be gone when the last QImage using the buffer is released */
+    struct FrameStream::FrameBuffer {
+        std::weak_ptr<FrameStream> stream;
+        uchar *data;
+        qsizetype bytes;
+    };
+
+    static qint64 nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    FrameStream::FrameStream(const QString &id, int frameCount, std::function<void()> onFrame) :
+        m_id(id),
+        m_frameCount(qMax(frameCount, 1)),
+        m_onFrame(std::move(onFrame)),
+        m_bufferBytes(0),
+        m_format(QImage::Format_Invalid),
+        m_latestTime(0),
+        m_latestShown(true),
+        m_totalLatencyUs(0) {
+        memset(&m_stats, 0, sizeof(m_stats));
+    }
+
+    FrameStream::~FrameStream() {
+        for (uchar *data : m_free) free(data);
+    }
+
+    void FrameStream::recycleBuffer(void *info) {
+        FrameBuffer *buffer = static_cast<FrameBuffer *>(info);
+        FrameStreamPtr stream = buffer->stream.lock();
+        if (stream) {
+            stream->recycle(buffer->data, buffer->bytes);
+        } else {
+            free(buffer->data);
+        }
+        delete buffer;
+    }
+
+    /**
+     * @fn recycle
+     * @brief Put a released buffer back in the ring, buffers of an older frame size or beyond the ring are freed.
+     * QImages of the stream are never released with m_mtx held, this is called from their cleanup function.
+     */
+    void FrameStream::recycle(uchar *data, qsizetype bytes) {
+        {
+            QMutexLocker locker(&m_mtx);
+            if (bytes == m_bufferBytes && m_free.size() < m_frameCount) {
+                m_free.append(data);
+                return;
+            }
+        }
+        free(data);
+    }
+
+    QImage FrameStream::acquireFrame(const QSize &size, QImage::Format format) {
+        if (size.isEmpty() || format == QImage::Format_Invalid) return QImage();
+
+        const int bytesPerLine = ((size.width() * QImage::toPixelFormat(format).bitsPerPixel() + 31) / 32) * 4;
+        const qsizetype bytes = static_cast<qsizetype>(bytesPerLine) * size.height();
+        uchar *data = NULL;
+        QList<uchar *> stale;
+        {
+            QMutexLocker locker(&m_mtx);
+            if (size != m_size || format != m_format) {
+                /* The feed changed geometry, the recycled buffers do not fit anymore */
+                stale.swap(m_free);
+                m_size = size;
+                m_format = format;
+                m_bufferBytes = bytes;
+            }
+            if (!m_free.isEmpty()) {
+                data = m_free.takeLast();
+            } else {
+                m_stats.allocations++;
+            }
+        }
+        for (uchar *buffer : stale) free(buffer);
+
+        if (!data) data = static_cast<uchar *>(malloc(bytes));
+        if (!data) return QImage();
+
+        FrameBuffer *buffer = new FrameBuffer();
+        buffer->stream = weak_from_this();
+        buffer->data = data;
+        buffer->bytes = bytes;
+        return QImage(data, size.width(), size.height(), bytesPerLine, format, recycleBuffer, buffer);
+    }
+
+    void FrameStream::publishFrame(QImage frame) {
+        if (frame.isNull()) return;
+        {
+            QMutexLocker locker(&m_mtx);
+            if (!m_latestShown) m_stats.dropped++;
+            m_latest.swap(frame);
+            m_latestTime = nowUs();
+            m_latestShown = false;
+            m_stats.published++;
+        }
+        /* Release the replaced frame out of the lock, its buffer goes back to the ring */
+        frame = QImage();
+        if (m_onFrame) m_onFrame();
+    }
+
+    void FrameStream::pushFrame(const QImage &image) {
+        QImage frame = acquireFrame(image.size(), image.format());
+        if (frame.isNull()) return;
+
+        const int lineBytes = qMin(frame.bytesPerLine(), image.bytesPerLine());
+        for (int y = 0; y < image.height(); y++) {
+            memcpy(frame.scanLine(y), image.constScanLine(y), lineBytes);
+        }
+        /* Indexed and mono frames need their palette, a recycled buffer holds the one of an older frame (or none) */
+        if (image.colorCount() > 0 || frame.colorCount() > 0) frame.setColorTable(image.colorTable());
+        publishFrame(std::move(frame));
+    }
+
+    QImage FrameStream::takeFrame() {
+        QMutexLocker locker(&m_mtx);
+        if (!m_latestShown && !m_latest.isNull()) {
+            qint64 latency = nowUs() - m_latestTime;
+            m_latestShown = true;
+            m_stats.shown++;
+            m_stats.lastLatencyUs = latency;
+            m_totalLatencyUs += latency;
+            m_stats.averageLatencyUs = m_totalLatencyUs / static_cast<qint64>(m_stats.shown);
+        }
+        return m_latest;
+    }
+
+    FrameStreamStats FrameStream::stats() {
+        QMutexLocker locker(&m_mtx);
+        return m_stats;
+    }
+} // namespace qtwrapper
@@ -0,0 +1,109 @@
+/**
+ * @file framestream.h
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef __FRAMESTREAM_H__
+#define __FRAMESTREAM_H__
+
+#include <QImage>
+#include <QString>
+#include <QMutex>
+#include <QList>
+#include <functional>
+#include <memory>
+
+namespace qtwrapper
+{
+    /**
+     * @fn FrameStreamStats
+     * @brief Counters of a FrameStream, latencies are from publishFrame to takeFrame
+     */
+    typedef struct {
+        quint64 published;
+        quint64 shown;
+        /* Frames replaced by a newer one before the UI took them */
+        quint64 dropped;
+        /* Pixel buffers allocated, the rest of the frames reused a recycled buffer */
+        quint64 allocations;
+        qint64 lastLatencyUs;
+        qint64 averageLatencyUs;
+    } FrameStreamStats;
+
+    /**
+     * @fn FrameStream
+     * @brief Latest frame wins delivery of a high rate image feed (camera, video) to the UI.
+     * Frames are written into a small ring of recycled pixel buffers, a buffer goes back to the ring when the
+     * last QImage using it is released. Publishing never blocks on the UI: a frame which was not taken before
+     * the next one is published is dropped. Methods can be called from any thread.
+     */
+    class FrameStream : public std::enable_shared_from_this<FrameStream>
+    {
+    private:
+        struct FrameBuffer;
+
+        QString m_id;
+        int m_frameCount;
+        std::function<void()> m_onFrame;
+        QMutex m_mtx;
+        /* Released buffers of the current frame size and format */
+        QList<uchar *> m_free;
+        qsizetype m_bufferBytes;
+        QSize m_size;
+        QImage::Format m_format;
+        QImage m_latest;
+        qint64 m_latestTime;
+        bool m_latestShown;
+        FrameStreamStats m_stats;
+        qint64 m_totalLatencyUs;
+
+        static void recycleBuffer(void *info);
+        void recycle(uchar *data, qsizetype bytes);
+
+    public:
+        /**
+         * @param id            Image id of the stream (this value is mapping with "source" in qml)
+         * @param frameCount    Buffers kept for reuse: one written, one published, one shown by default
+         * @param onFrame       Called on each published frame
+         */
+        FrameStream(const QString &id, int frameCount, std::function<void()> onFrame);
+        ~FrameStream();
+
+        QString id() const { return m_id; }
+
+        /**
+         * @fn acquireFrame
+         * @brief Get a writable frame backed by a recycled buffer, fill it then give it to publishFrame
+         */
+        QImage acquireFrame(const QSize &size, QImage::Format format);
+
+        /**
+         * @fn publishFrame
+         * @brief Make a frame the latest one, the previous one is dropped if it was not taken yet
+         */
+        void publishFrame(QImage frame);
+
+        /**
+         * @fn pushFrame
+         * @brief Copy an image into a recycled buffer and publish it
+         */
+        void pushFrame(const QImage &image);
+
+        /**
+         * @fn takeFrame
+         * @brief Latest frame for display, a shallow copy
+         */
+        QImage takeFrame();
+
+        FrameStreamStats stats();
+    };
+
+    using FrameStreamPtr = std::shared_ptr<FrameStream>;
+} // namespace qtwrapper
+#endif // __FRAMESTREAM_H__
@@ -0,0 +1,228 @@
+/**
+ * @file gradientregistry.cpp
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "gradientregistry.h"
+#include <QPainter>
+#include <QColor>
+#include <algorithm>
+#include <cmath>
+
+namespace qtwrapper
+{
+    /* Sizes rasterized per gradient, a list of same sized delegates only needs one */
+    static const int sMaxRasters = 4;
+
+    static QByteArray keyNumber(const QVariantMap &map, const char *name) {
+        return QByteArray(name) + "=" + QByteArray::number(map[name].toDouble(), 'g', 17) + ";";
+    }
+
+    SharedGradient::SharedGradient(const QGradient &gradient) :
+        m_gradient(gradient) {
+        /* Stops are premultiplied first and interpolated premultiplied, like QGradient::ColorInterpolation,
+         * so a stop fading to transparent does not bring its color into the fade */
+        const QGradientStops stops = m_gradient.stops();
+        auto premultiplied = [](const QColor &color, qreal *out) {
+            const qreal alpha = color.alphaF();
+            out[0] = alpha;
+            out[1] = color.redF() * alpha;
+            out[2] = color.greenF() * alpha;
+            out[3] = color.blueF() * alpha;
+        };
+        for (int i = 0; i < 256; i++) {
+            const qreal t = i / 255.0;
+            qreal argb[4];
+            if (stops.isEmpty()) {
+                m_lut[i] = 0;
+                continue;
+            }
+            if (t <= stops.first().first) {
+                premultiplied(stops.first().second, argb);
+            } else if (t >= stops.last().first) {
+                premultiplied(stops.last().second, argb);
+            } else {
+                int s = 1;
+                while (stops[s].first < t) s++;
+                const QGradientStop &a = stops[s - 1];
+                const QGradientStop &b = stops[s];
+                const qreal f = (b.first > a.first) ? (t - a.first) / (b.first - a.first) : 0;
+                qreal from[4], to[4];
+                premultiplied(a.second, from);
+                premultiplied(b.second, to);
+                for (int c = 0; c < 4; c++) argb[c] = from[c] + (to[c] - from[c]) * f;
+            }
+            m_lut[i] = 0;
+            for (int c = 0; c < 4; c++) m_lut[i] = (m_lut[i] << 8) | static_cast<quint32>(qBound(0, qRound(argb[c] * 255), 255));
+        }
+    }
+
+    QGradient SharedGradient::resolved(const QSize &size) const {
+        if (m_gradient.type() != QGradient::LinearGradient) return m_gradient;
+
+        const QLinearGradient &linear = static_cast<const QLinearGradient &>(m_gradient);
+        if (linear.start() != QPointF(0, 0) || linear.finalStop() != QPointF(0, 0)) return m_gradient;
+
+        QLinearGradient gradient(QPointF(0, 0), QPointF(0, size.height()));
+        gradient.setStops(m_gradient.stops());
+        gradient.setCoordinateMode(m_gradient.coordinateMode());
+        return gradient;
+    }
+
+    /**
+     * @fn rasterize
+     * @brief Linear gradients are drawn from the lookup table, one index per pixel center,
+     * the other types through QPainter. The mask is the alpha of the tint.
+     */
+    void SharedGradient::rasterize(const QSize &size, QImage &mask, QImage &tint) const {
+        tint = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        if (tint.isNull()) {
+            mask = QImage();
+            return;
+        }
+        QGradient gradient = resolved(size);
+        if (gradient.type() == QGradient::LinearGradient) {
+            const QLinearGradient &linear = static_cast<const QLinearGradient &>(gradient);
+            const qreal dx = linear.finalStop().x() - linear.start().x();
+            const qreal dy = linear.finalStop().y() - linear.start().y();
+            const qreal l2 = dx * dx + dy * dy;
+            for (int y = 0; y < size.height(); y++) {
+                quint32 *line = reinterpret_cast<quint32 *>(tint.scanLine(y));
+                if (l2 <= 0) {
+                    std::fill(line, line + size.width(), m_lut[0]);
+                    continue;
+                }
+                /* Position along the gradient, pad spread */
+                qreal t = ((0.5 - linear.start().x()) * dx + (y + 0.5 - linear.start().y()) * dy) / l2;
+                const qreal step = dx / l2;
+                for (int x = 0; x < size.width(); x++, t += step) {
+                    int index = static_cast<int>(std::floor(t * 255 + 0.5));
+                    line[x] = m_lut[qBound(0, index, 255)];
+                }
+            }
+        } else {
+            tint.fill(Qt::transparent);
+            QPainter painter(&tint);
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            painter.fillRect(tint.rect(), gradient);
+            painter.end();
+        }
+
+        mask = QImage(size, QImage::Format_Alpha8);
+        for (int y = 0; y < size.height(); y++) {
+            const quint32 *in = reinterpret_cast<const quint32 *>(tint.constScanLine(y));
+            uchar *out = mask.scanLine(y);
+            for (int x = 0; x < size.width(); x++) out[x] = in[x] >> 24;
+        }
+    }
+
+    void SharedGradient::rasters(const QSize &size, QImage &mask, QImage &tint) {
+        {
+            QMutexLocker locker(&m_mtx);
+            for (int i = 0; i < m_rasters.size(); i++) {
+                if (m_rasters[i].size != size) continue;
+                if (i > 0) m_rasters.move(i, 0);
+                mask = m_rasters.first().mask;
+                tint = m_rasters.first().tint;
+                return;
+            }
+        }
+
+        /* Rasterize out of the lock, two items racing on a new size both draw it and keep one */
+        GradientRaster raster;
+        raster.size = size;
+        rasterize(size, raster.mask, raster.tint);
+
+        QMutexLocker locker(&m_mtx);
+        for (auto &cached : m_rasters) {
+            if (cached.size != size) continue;
+            mask = cached.mask;
+            tint = cached.tint;
+            return;
+        }
+        m_rasters.prepend(raster);
+        while (m_rasters.size() > sMaxRasters) m_rasters.removeLast();
+        mask = raster.mask;
+        tint = raster.tint;
+    }
+
+    GradientRegistry *GradientRegistry::instance() {
+        static GradientRegistry registry;
+        return &registry;
+    }
+
+    SharedGradientPtr GradientRegistry::intern(const QVariantMap &map) {
+        QGradient::Type type = static_cast<QGradient::Type>(map["type"].toInt());
+        QByteArray key = "type=" + QByteArray::number(static_cast<int>(type)) + ";";
+        QGradient gradient;
+        switch (type) {
+        case QGradient::LinearGradient: {
+            QPointF startP(map["x1"].toDouble(), map["y1"].toDouble());
+            QPointF stopP(map["x2"].toDouble(), map["y2"].toDouble());
+            gradient = QLinearGradient(startP, stopP);
+            key += keyNumber(map, "x1") + keyNumber(map, "y1") + keyNumber(map, "x2") + keyNumber(map, "y2");
+        } break;
+        case QGradient::RadialGradient: {
+            QPointF cp(map["centerX"].toDouble(), map["centerY"].toDouble());
+            QPointF fp(map["focalX"].toDouble(), map["focalY"].toDouble());
+            qreal centerRadius = map["centerRadius"].toDouble();
+            qreal focalRadius = map["focalRadius"].toDouble();
+
+            if (focalRadius != 0)
+                gradient = QRadialGradient(cp, centerRadius, fp, focalRadius);
+            else
+                gradient = QRadialGradient(cp, centerRadius);
+            key += keyNumber(map, "centerX") + keyNumber(map, "centerY") + keyNumber(map, "focalX") + keyNumber(map, "focalY") +
+                   keyNumber(map, "centerRadius") + keyNumber(map, "focalRadius");
+        } break;
+        case QGradient::ConicalGradient: {
+            QPointF cP(map["centerX"].toDouble(), map["centerY"].toDouble());
+            gradient = QConicalGradient(cP, map["angle"].toDouble());
+            key += keyNumber(map, "centerX") + keyNumber(map, "centerY") + keyNumber(map, "angle");
+        } break;
+        default:
+            return NULL;
+        }
+
+        gradient.setCoordinateMode(QGradient::LogicalMode);
+        for (auto stopVariant : map["stops"].toList()) {
+            QVariantMap stopMap = stopVariant.toMap();
+            double position = stopMap["position"].toDouble();
+            QColor color(stopMap["color"].toString());
+            gradient.setColorAt(position, color);
+        }
+        for (const QGradientStop &stop : gradient.stops()) {
+            key += "stop=" + QByteArray::number(stop.first, 'g', 17) + ":" + QByteArray::number(stop.second.rgba(), 16) + ";";
+        }
+
+        QMutexLocker locker(&m_mtx);
+        auto p = m_gradients.find(key);
+        if (p != m_gradients.end()) {
+            SharedGradientPtr shared = p->second.lock();
+            if (shared) return shared;
+        }
+
+        /* New style, drop the ones no item uses anymore */
+        for (auto it = m_gradients.begin(); it != m_gradients.end();) {
+            if (it->second.expired()) {
+                it = m_gradients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        auto shared = std::make_shared<SharedGradient>(gradient);
+        m_gradients[key] = shared;
+        return shared;
+    }
+
+    int GradientRegistry::count() {
+        QMutexLocker locker(&m_mtx);
+        return static_cast<int>(m_gradients.size());
+    }
+} // namespace qtwrapper
@@ -0,0 +1,99 @@
+/**
+ * @file gradientregistry.h
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef __GRADIENTREGISTRY_H__
+#define __GRADIENTREGISTRY_H__
+
+#include <QGradient>
+#include <QImage>
+#include <QMutex>
+#include <QList>
+#include <QVariantMap>
+#include <map>
+#include <memory>
+
+namespace qtwrapper
+{
+    /**
+     * @fn SharedGradient
+     * @brief Parsed gradient shared by every OpacityImage with the same style, immutable once interned.
+     * It holds a 256 entry lookup table of premultiplied colors along the gradient and the rasterized
+     * tint (ARGB32 premultiplied) and mask (Alpha8) of the last sizes it was drawn at.
+     */
+    class SharedGradient
+    {
+    private:
+        typedef struct {
+            QSize size;
+            QImage mask;
+            QImage tint;
+        } GradientRaster;
+
+        QGradient m_gradient;
+        quint32 m_lut[256];
+        QMutex m_mtx;
+        /* Most recently used first */
+        QList<GradientRaster> m_rasters;
+
+        void rasterize(const QSize &size, QImage &mask, QImage &tint) const;
+
+    public:
+        explicit SharedGradient(const QGradient &gradient);
+
+        const QGradient &gradient() const { return m_gradient; }
+
+        /**
+         * @fn lut
+         * @brief Premultiplied ARGB32 color at position i / 255 of the gradient
+         */
+        const quint32 *lut() const { return m_lut; }
+
+        /**
+         * @fn resolved
+         * @brief Gradient laid out for an item of this size, a linear gradient without coordinates goes from top to bottom
+         */
+        QGradient resolved(const QSize &size) const;
+
+        /**
+         * @fn rasters
+         * @brief Tint and mask of the gradient at this size, shared with every user of the gradient
+         */
+        void rasters(const QSize &size, QImage &mask, QImage &tint);
+    };
+
+    using SharedGradientPtr = std::shared_ptr<SharedGradient>;
+
+    /**
+     * @fn GradientRegistry
+     * @brief Interns gradients by type, geometry and stops. A gradient lives as long as one item uses it.
+     */
+    class GradientRegistry
+    {
+    private:
+        QMutex m_mtx;
+        std::map<QByteArray, std::weak_ptr<SharedGradient>> m_gradients;
+
+    public:
+        static GradientRegistry *instance();
+
+        /**
+         * @fn intern
+         * @brief Shared gradient of a parsed "gradient" property of OpacityImage
+         *
+         * @param map       type, coordinates of the type and stops (list of position / color)
+         * @return SharedGradientPtr    NULL if the type is unknown
+         */
+        SharedGradientPtr intern(const QVariantMap &map);
+
+        int count();
+    };
+} // namespace qtwrapper
+#endif // __GRADIENTREGISTRY_H__
@@ -0,0 +1,181 @@
+/**
+ * @file imagecache.cpp
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "imagecache.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <algorithm>
+#include <string.h>
+
+namespace qtwrapper
+{
+#define IMAGE_CACHE_MAGIC   "QTWIMGC"
+#define IMAGE_CACHE_VERSION 1
+#define IMAGE_CACHE_SUFFIX  ".qic"
+
+    /* Pixels start right after the header, 64 bytes keeps every row start aligned for SIMD loads */
+    typedef struct {
+        char magic[8];
+        quint32 version;
+        quint32 headerSize;
+        quint32 format;
+        quint32 width;
+        quint32 height;
+        quint32 bytesPerLine;
+        qint32 maxWidth;
+        qint32 maxHeight;
+        quint8 hash[20];
+        quint8 reserved[4];
+    } ImageCacheHeader;
+
+    static_assert(sizeof(ImageCacheHeader) == 64, "ImageCacheHeader must be 64 bytes");
+
+    /* A hit refreshes the modification time of its entry at most this often, it is the age used by prune */
+    static const qint64 sTouchInterval = 24 * 3600;
+
+    static void unmapCachedImage(void *info) {
+        /* The descriptor is already closed, deleting the QFile unmaps the pixels */
+        delete static_cast<QFile *>(info);
+    }
+
+    /**
+     * @fn ImageDiskCache
+     * @brief Construct a new Image Disk Cache:: Image Disk Cache object
+     *
+     */
+    ImageDiskCache::ImageDiskCache(const QString &directory, qint64 maxBytes, int maxAgeDays) :
+        m_directory(directory),
+        m_maxBytes(maxBytes > 0 ? maxBytes : 0),
+        m_maxAgeDays(maxAgeDays > 0 ? maxAgeDays : 0),
+        m_writtenBytes(0) {
+        QDir().mkpath(m_directory);
+    }
+
+    QByteArray ImageDiskCache::contentHash(const QByteArray &data) {
+        return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    }
+
+    QString ImageDiskCache::filePath(const QByteArray &hash, const QSize &maxSize) const {
+        QString name = QString::fromLatin1(hash.toHex());
+        if (maxSize.width() > 0 || maxSize.height() > 0) {
+            name += QString("_%1x%2").arg(maxSize.width()).arg(maxSize.height());
+        }
+        return m_directory + "/" + name + IMAGE_CACHE_SUFFIX;
+    }
+
+    QImage ImageDiskCache::load(const QByteArray &hash, const QSize &maxSize) {
+        if (hash.size() != 20) return QImage();
+
+        QFile *file = new QFile(filePath(hash, maxSize));
+        if (!file->open(QIODevice::ReadOnly)) {
+            delete file;
+            return QImage();
+        }
+
+        ImageCacheHeader header;
+        const qint64 size = file->size();
+        bool valid = file->read(reinterpret_cast<char *>(&header), sizeof(header)) == (qint64)sizeof(header) &&
+                     memcmp(header.magic, IMAGE_CACHE_MAGIC, sizeof(IMAGE_CACHE_MAGIC)) == 0 &&
+                     header.version == IMAGE_CACHE_VERSION &&
+                     header.headerSize == sizeof(ImageCacheHeader) &&
+                     header.format == QImage::Format_ARGB32_Premultiplied &&
+                     header.width > 0 && header.height > 0 &&
+                     header.bytesPerLine >= header.width * 4 &&
+                     header.maxWidth == maxSize.width() && header.maxHeight == maxSize.height() &&
+                     memcmp(header.hash, hash.constData(), sizeof(header.hash)) == 0 &&
+                     size == (qint64)header.headerSize + (qint64)header.bytesPerLine * header.height;
+
+        uchar *mapped = valid ? file->map(header.headerSize, size - header.headerSize) : NULL;
+        if (!mapped) {
+            /* Truncated, corrupted or from another version: drop it, it is written again on the next decode */
+            file->close();
+            if (!valid) file->remove();
+            delete file;
+            return QImage();
+        }
+
+        const QDateTime now = QDateTime::currentDateTimeUtc();
+        if (file->fileTime(QFileDevice::FileModificationTime).secsTo(now) > sTouchInterval) {
+            file->setFileTime(now, QFileDevice::FileModificationTime);
+        }
+
+        /* The mapping outlives the descriptor, no file stays open per cached image */
+        file->close();
+
+        /* Read-only image over the mapping, the file is unmapped once the last copy of the image is gone */
+        return QImage(static_cast<const uchar *>(mapped), header.width, header.height, header.bytesPerLine,
+                      QImage::Format_ARGB32_Premultiplied, unmapCachedImage, file);
+    }
+
+    bool ImageDiskCache::store(const QByteArray &hash, const QSize &maxSize, const QImage &image) {
+        if (hash.size() != 20 || image.isNull()) return false;
+
+        QImage pixels = image.format() == QImage::Format_ARGB32_Premultiplied ? image : image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+        ImageCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, IMAGE_CACHE_MAGIC, sizeof(IMAGE_CACHE_MAGIC));
+        header.version = IMAGE_CACHE_VERSION;
+        header.headerSize = sizeof(ImageCacheHeader);
+        header.format = QImage::Format_ARGB32_Premultiplied;
+        header.width = pixels.width();
+        header.height = pixels.height();
+        header.bytesPerLine = pixels.bytesPerLine();
+        header.maxWidth = maxSize.width();
+        header.maxHeight = maxSize.height();
+        memcpy(header.hash, hash.constData(), sizeof(header.hash));
+
+        const qint64 pixelBytes = (qint64)pixels.bytesPerLine() * pixels.height();
+        QSaveFile file(filePath(hash, maxSize));
+        if (!file.open(QIODevice::WriteOnly)) return false;
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(pixels.constBits()), pixelBytes);
+        if (!file.commit()) return false;
+
+        /* Prune each time about a quarter of the budget was written */
+        const qint64 bytes = sizeof(header) + pixelBytes;
+        if (m_maxBytes > 0 && m_writtenBytes.fetch_add(bytes) + bytes > m_maxBytes / 4) prune();
+        return true;
+    }
+
+    void ImageDiskCache::prune() {
+        /* One prune at a time, a store finding one running leaves the work to it */
+        if (!m_pruneMtx.tryLock()) return;
+        m_writtenBytes = 0;
+
+        QDir dir(m_directory);
+        QFileInfoList files = dir.entryInfoList(QStringList() << QString("*" IMAGE_CACHE_SUFFIX), QDir::Files, QDir::Time | QDir::Reversed);
+        const QDateTime oldest = QDateTime::currentDateTimeUtc().addDays(-m_maxAgeDays);
+
+        qint64 total = 0;
+        for (auto &info : files) total += info.size();
+
+        /* Oldest first: entries past the age limit, then as many as needed to fit in the byte budget.
+         * Images still mapped stay valid, only the file name is removed. */
+        for (auto &info : files) {
+            bool expired = m_maxAgeDays > 0 && info.lastModified() < oldest;
+            if (!expired && (m_maxBytes <= 0 || total <= m_maxBytes)) break;
+            if (dir.remove(info.fileName())) total -= info.size();
+        }
+        m_pruneMtx.unlock();
+    }
+
+    void ImageDiskCache::clear() {
+        QDir dir(m_directory);
+        for (auto &name : dir.entryList(QStringList() << QString("*" IMAGE_CACHE_SUFFIX), QDir::Files)) {
+            dir.remove(name);
+        }
+    }
+} // namespace qtwrapper
@@ -0,0 +1,94 @@
+/**
+ * @file imagecache.h
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef __IMAGECACHE_H__
+#define __IMAGECACHE_H__
+
+#include <QImage>
+#include <QString>
+#include <QByteArray>
+#include <QMutex>
+#include <atomic>
+
+namespace qtwrapper
+{
+    /**
+     * @fn ImageDiskCache
+     * @brief Persistent cache of decoded images, used to skip JPEG/PNG decoding on the next start.
+     * Each entry is one file: a fixed header followed by raw Format_ARGB32_Premultiplied pixels.
+     * Entries are keyed by the hash of the encoded source and the requested decode size, so a changed
+     * source never hits an old entry. Loaded images are backed by a read-only mapping of the file,
+     * nothing is decoded or copied, and no file descriptor is kept open.
+     */
+    class ImageDiskCache
+    {
+    private:
+        QString m_directory;
+        qint64 m_maxBytes;
+        int m_maxAgeDays;
+        /* Bytes stored since the last prune */
+        std::atomic<qint64> m_writtenBytes;
+        QMutex m_pruneMtx;
+
+        QString filePath(const QByteArray &hash, const QSize &maxSize) const;
+
+    public:
+        /**
+         * @fn ImageDiskCache
+         * @brief Cache in "directory", limited to maxBytes of entries and to entries used in the last maxAgeDays
+         * (0 for no limit). The limits are applied by prune.
+         */
+        explicit ImageDiskCache(const QString &directory, qint64 maxBytes = 0, int maxAgeDays = 0);
+
+        /**
+         * @fn contentHash
+         * @brief Hash of encoded image data, used as the cache key
+         */
+        static QByteArray contentHash(const QByteArray &data);
+
+        QString directory() const { return m_directory; }
+
+        /**
+         * @fn load
+         * @brief Map a cached image. An entry which fails validation is removed.
+         *
+         * @param hash      contentHash of the encoded source
+         * @param maxSize   Size the source was decoded to fit in (empty for full size)
+         * @return QImage   Image backed by the mapped file, null if not cached
+         */
+        QImage load(const QByteArray &hash, const QSize &maxSize);
+
+        /**
+         * @fn store
+         * @brief Write a decoded image to the cache, the file is replaced atomically
+         *
+         * @param hash      contentHash of the encoded source
+         * @param maxSize   Size the source was decoded to fit in (empty for full size)
+         * @param image     Decoded image, converted to Format_ARGB32_Premultiplied if needed
+         * @return true     The image was written
+         */
+        bool store(const QByteArray &hash, const QSize &maxSize, const QImage &image);
+
+        /**
+         * @fn prune
+         * @brief Remove the entries not used for maxAgeDays, then the least recently used ones until
+         * the cache fits in maxBytes. It also runs from store each time about a quarter of maxBytes was written.
+         */
+        void prune();
+
+        /**
+         * @fn clear
+         * @brief Remove every cached image
+         */
+        void clear();
+    };
+} // namespace qtwrapper
+#endif // __IMAGECACHE_H__
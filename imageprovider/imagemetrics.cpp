@@ -0,0 +1,214 @@
+/**
+ * @file imagemetrics.cpp
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "imagemetrics.h"
+#include <QVariantList>
+#include <chrono>
+#include <string.h>
+
+namespace qtwrapper
+{
+    static qint64 nowSecond() {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @fn sizeClass
+     * @brief Decoded size class of an image, in pixels
+     */
+    static const char *sizeClass(const QSize &size) {
+        qint64 pixels = static_cast<qint64>(size.width()) * size.height();
+        if (pixels <= 256 * 256) return "64K";
+        if (pixels <= 1024 * 1024) return "1M";
+        if (pixels <= 2048 * 2048) return "4M";
+        return "large";
+    }
+
+    /**
+     * @fn bucketOf
+     * @brief Histogram bucket of a duration: the first power of two above it
+     */
+    static int bucketOf(qint64 us) {
+        int bucket = 0;
+        while (bucket < LATENCY_HISTOGRAM_BUCKETS - 1 && us >= (static_cast<qint64>(1) << bucket)) bucket++;
+        return bucket;
+    }
+
+    LatencyHistogram::LatencyHistogram() :
+        count(0),
+        totalUs(0),
+        maxUs(0) {
+        memset(buckets, 0, sizeof(buckets));
+    }
+
+    void LatencyHistogram::add(qint64 us) {
+        if (us < 0) us = 0;
+        const int bucket = bucketOf(us);
+        buckets[bucket]++;
+        count++;
+        totalUs += us;
+        maxUs = qMax(maxUs, us);
+    }
+
+    qint64 LatencyHistogram::averageUs() const {
+        return count ? totalUs / static_cast<qint64>(count) : 0;
+    }
+
+    qint64 LatencyHistogram::percentileUs(double p) const {
+        if (!count) return 0;
+        quint64 rank = static_cast<quint64>(p * count);
+        quint64 seen = 0;
+        for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS - 1; i++) {
+            seen += buckets[i];
+            if (seen > rank) return static_cast<qint64>(1) << i;
+        }
+        return maxUs;
+    }
+
+    QVariantMap LatencyHistogram::toVariantMap() const {
+        QVariantList list;
+        for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) list.append(static_cast<qulonglong>(buckets[i]));
+
+        QVariantMap map;
+        map["count"] = static_cast<qulonglong>(count);
+        map["averageUs"] = averageUs();
+        map["maxUs"] = maxUs;
+        map["p50Us"] = percentileUs(0.5);
+        map["p99Us"] = percentileUs(0.99);
+        map["buckets"] = list;
+        return map;
+    }
+
+    AtomicLatencyHistogram::AtomicLatencyHistogram() {
+        reset();
+    }
+
+    void AtomicLatencyHistogram::add(qint64 us) {
+        if (us < 0) us = 0;
+        const int bucket = bucketOf(us);
+        m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_totalUs.fetch_add(us, std::memory_order_relaxed);
+
+        qint64 max = m_maxUs.load(std::memory_order_relaxed);
+        while (us > max && !m_maxUs.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+        }
+    }
+
+    LatencyHistogram AtomicLatencyHistogram::snapshot() const {
+        LatencyHistogram histogram;
+        histogram.count = m_count.load(std::memory_order_relaxed);
+        histogram.totalUs = m_totalUs.load(std::memory_order_relaxed);
+        histogram.maxUs = m_maxUs.load(std::memory_order_relaxed);
+        for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) histogram.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        return histogram;
+    }
+
+    void AtomicLatencyHistogram::reset() {
+        m_count = 0;
+        m_totalUs = 0;
+        m_maxUs = 0;
+        for (auto &bucket : m_buckets) bucket = 0;
+    }
+
+    ImageMetrics::ImageMetrics() :
+        m_requestHits(0),
+        m_requestMisses(0),
+        m_reloads(0),
+        m_notifications(0),
+        m_rateSecond(0),
+        m_rateCurrent(0),
+        m_rateLast(0) {
+    }
+
+    ImageMetrics *ImageMetrics::instance() {
+        static ImageMetrics metrics;
+        return &metrics;
+    }
+
+    void ImageMetrics::recordRequest(bool hit) {
+        if (hit) {
+            m_requestHits.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            m_requestMisses.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void ImageMetrics::recordReload() {
+        m_reloads.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void ImageMetrics::recordDecode(const QByteArray &format, const QSize &size, qint64 us) {
+        QString key = QString::fromLatin1(format.isEmpty() ? QByteArray("unknown") : format) + ":" + sizeClass(size);
+        QMutexLocker locker(&m_mtx);
+        m_decodes[key].add(us);
+    }
+
+    void ImageMetrics::recordLockWait(qint64 us) {
+        m_lockWait.add(us);
+    }
+
+    /**
+     * @fn rollRate
+     * @brief Move the rate window to "second". The thread which wins the move closes the window, a notification
+     * recorded by another thread at that instant may be counted in the neighbouring second.
+     */
+    void ImageMetrics::rollRate(qint64 second) {
+        qint64 current = m_rateSecond.load(std::memory_order_relaxed);
+        if (second == current || !m_rateSecond.compare_exchange_strong(current, second)) return;
+        quint64 count = m_rateCurrent.exchange(0);
+        m_rateLast = (second == current + 1) ? count : 0;
+    }
+
+    void ImageMetrics::recordNotifications(int ids) {
+        rollRate(nowSecond());
+        m_notifications.fetch_add(ids, std::memory_order_relaxed);
+        m_rateCurrent.fetch_add(ids, std::memory_order_relaxed);
+    }
+
+    std::map<QString, LatencyHistogram> ImageMetrics::decodes() {
+        QMutexLocker locker(&m_mtx);
+        return m_decodes;
+    }
+
+    quint64 ImageMetrics::notificationRate() {
+        rollRate(nowSecond());
+        return m_rateLast.load();
+    }
+
+    QVariantMap ImageMetrics::toVariantMap() {
+        QVariantMap map;
+        map["requestHits"] = static_cast<qulonglong>(requestHits());
+        map["requestMisses"] = static_cast<qulonglong>(requestMisses());
+        map["reloads"] = static_cast<qulonglong>(reloads());
+        map["lockWait"] = lockWait().toVariantMap();
+        map["notifications"] = static_cast<qulonglong>(notifications());
+        map["notificationRate"] = static_cast<qulonglong>(notificationRate());
+
+        QMutexLocker locker(&m_mtx);
+        QVariantMap decodes;
+        for (auto &decode : m_decodes) decodes[decode.first] = decode.second.toVariantMap();
+        map["decodes"] = decodes;
+        return map;
+    }
+
+    void ImageMetrics::reset() {
+        m_requestHits = 0;
+        m_requestMisses = 0;
+        m_reloads = 0;
+        m_lockWait.reset();
+        m_notifications = 0;
+        m_rateCurrent = 0;
+        m_rateLast = 0;
+        QMutexLocker locker(&m_mtx);
+        m_decodes.clear();
+    }
+} // namespace qtwrapper
@@ -0,0 +1,117 @@
+/**
+ * @file imagemetrics.h
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef __IMAGEMETRICS_H__
+#define __IMAGEMETRICS_H__
+
+#include <QMutex>
+#include <QSize>
+#include <QString>
+#include <QVariantMap>
+#include <atomic>
+#include <map>
+
+namespace qtwrapper
+{
+#define LATENCY_HISTOGRAM_BUCKETS 24
+
+    /**
+     * @fn LatencyHistogram
+     * @brief Durations in microseconds, bucket i counts the durations below 2^i us (the last one the rest)
+     */
+    struct LatencyHistogram {
+        quint64 count;
+        qint64 totalUs;
+        qint64 maxUs;
+        quint64 buckets[LATENCY_HISTOGRAM_BUCKETS];
+
+        LatencyHistogram();
+        void add(qint64 us);
+        qint64 averageUs() const;
+        /* Upper bound of the bucket holding the percentile p (0 to 1) */
+        qint64 percentileUs(double p) const;
+        QVariantMap toVariantMap() const;
+    };
+
+    /**
+     * @fn AtomicLatencyHistogram
+     * @brief LatencyHistogram recorded without locking, for durations measured on hot paths.
+     * A snapshot taken while other threads record can be off by the records in flight.
+     */
+    class AtomicLatencyHistogram
+    {
+    private:
+        std::atomic<quint64> m_count;
+        std::atomic<qint64> m_totalUs;
+        std::atomic<qint64> m_maxUs;
+        std::atomic<quint64> m_buckets[LATENCY_HISTOGRAM_BUCKETS];
+
+    public:
+        AtomicLatencyHistogram();
+        void add(qint64 us);
+        LatencyHistogram snapshot() const;
+        void reset();
+    };
+
+    /**
+     * @fn ImageMetrics
+     * @brief Process wide counters of the image provider: requestImage hits and misses, reloads of evicted
+     * images, decode time per format and size, wait time of the store write lock and change notifications.
+     * Recording can be done from any thread. The counters recorded on every write lock and notification are
+     * atomics, only decodes (which take far longer than their recording) go through a mutex.
+     */
+    class ImageMetrics
+    {
+    private:
+        std::atomic<quint64> m_requestHits;
+        std::atomic<quint64> m_requestMisses;
+        std::atomic<quint64> m_reloads;
+        QMutex m_mtx;
+        /* Keyed by "<format>:<size class>", guarded by m_mtx */
+        std::map<QString, LatencyHistogram> m_decodes;
+        AtomicLatencyHistogram m_lockWait;
+        std::atomic<quint64> m_notifications;
+        /* Notifications of the current and of the last complete second */
+        std::atomic<qint64> m_rateSecond;
+        std::atomic<quint64> m_rateCurrent;
+        std::atomic<quint64> m_rateLast;
+
+        void rollRate(qint64 second);
+
+    public:
+        ImageMetrics();
+
+        static ImageMetrics *instance();
+
+        void recordRequest(bool hit);
+        void recordReload();
+        void recordDecode(const QByteArray &format, const QSize &size, qint64 us);
+        void recordLockWait(qint64 us);
+        void recordNotifications(int ids);
+
+        quint64 requestHits() const { return m_requestHits.load(); }
+        quint64 requestMisses() const { return m_requestMisses.load(); }
+        quint64 reloads() const { return m_reloads.load(); }
+        std::map<QString, LatencyHistogram> decodes();
+        LatencyHistogram lockWait() const { return m_lockWait.snapshot(); }
+        quint64 notifications() const { return m_notifications.load(); }
+        /* Change notifications during the last complete second */
+        quint64 notificationRate();
+
+        /**
+         * @fn toVariantMap
+         * @brief Every counter, for QML or logging
+         */
+        QVariantMap toVariantMap();
+        void reset();
+    };
+} // namespace qtwrapper
+#endif // __IMAGEMETRICS_H__
@@ -0,0 +1,127 @@
+/**
+ * @file imagepool.cpp
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "imagepool.h"
+#include <string.h>
+
+namespace qtwrapper
+{
+    /* Cache line alignment, rows of 4 byte pixels are also aligned for SIMD loads when the width allows it */
+    static const size_t sBufferAlignment = 64;
+    static const qsizetype sPageSize = 4096;
+
+    /* Cleanup info of a pooled image */
+    struct ImageBufferPool::PooledBuffer {
+        ImageBufferPool *pool;
+        uchar *data;
+        qsizetype bytes;
+    };
+
+    /**
+     * @fn sizeClass
+     * @brief Round a buffer size up to its class: whole pages, then 4 classes per power of two (25% waste at most)
+     */
+    static qsizetype sizeClass(qsizetype bytes) {
+        qsizetype pages = (bytes + sPageSize - 1) / sPageSize;
+        if (pages <= 4) return qMax<qsizetype>(pages, 1) * sPageSize;
+
+        qsizetype base = 1;
+        while (base * 2 <= pages) base *= 2;
+        qsizetype step = base / 4;
+        return ((pages + step - 1) / step) * step * sPageSize;
+    }
+
+    ImageBufferPool::ImageBufferPool(qint64 maxCachedBytes) :
+        m_maxCachedBytes(maxCachedBytes) {
+        memset(&m_stats, 0, sizeof(m_stats));
+    }
+
+    ImageBufferPool::~ImageBufferPool() {
+        trim();
+    }
+
+    ImageBufferPool *ImageBufferPool::instance() {
+        static ImageBufferPool *pool = new ImageBufferPool();
+        return pool;
+    }
+
+    void ImageBufferPool::releaseBuffer(void *info) {
+        PooledBuffer *buffer = static_cast<PooledBuffer *>(info);
+        buffer->pool->release(buffer->data, buffer->bytes);
+        delete buffer;
+    }
+
+    void ImageBufferPool::release(uchar *data, qsizetype bytes) {
+        {
+            QMutexLocker locker(&m_mtx);
+            if (m_stats.cachedBytes + bytes <= m_maxCachedBytes) {
+                m_free[bytes].append(data);
+                m_stats.cachedBytes += bytes;
+                return;
+            }
+            m_stats.discards++;
+        }
+        qFreeAligned(data);
+    }
+
+    QImage ImageBufferPool::allocate(const QSize &size, QImage::Format format) {
+        if (size.isEmpty() || format == QImage::Format_Invalid) return QImage();
+
+        const int bytesPerLine = ((size.width() * QImage::toPixelFormat(format).bitsPerPixel() + 31) / 32) * 4;
+        const qsizetype bytes = sizeClass(static_cast<qsizetype>(bytesPerLine) * size.height());
+        uchar *data = NULL;
+        {
+            QMutexLocker locker(&m_mtx);
+            auto p = m_free.find(bytes);
+            if (p != m_free.end() && !p->second.isEmpty()) {
+                data = p->second.takeLast();
+                m_stats.cachedBytes -= bytes;
+                m_stats.hits++;
+            } else {
+                m_stats.misses++;
+                m_stats.allocatedBytes += bytes;
+            }
+        }
+        if (!data) data = static_cast<uchar *>(qMallocAligned(bytes, sBufferAlignment));
+        if (!data) return QImage();
+
+        PooledBuffer *buffer = new PooledBuffer();
+        buffer->pool = this;
+        buffer->data = data;
+        buffer->bytes = bytes;
+        QImage image(data, size.width(), size.height(), bytesPerLine, format, releaseBuffer, buffer);
+        /* The cleanup function is not called for an image which could not be created */
+        if (image.isNull()) releaseBuffer(buffer);
+        return image;
+    }
+
+    void ImageBufferPool::setMaxCachedBytes(qint64 bytes) {
+        QMutexLocker locker(&m_mtx);
+        m_maxCachedBytes = bytes;
+    }
+
+    void ImageBufferPool::trim() {
+        std::map<qsizetype, QList<uchar *>> released;
+        {
+            QMutexLocker locker(&m_mtx);
+            released.swap(m_free);
+            m_stats.cachedBytes = 0;
+        }
+        for (auto &buffers : released) {
+            for (uchar *data : buffers.second) qFreeAligned(data);
+        }
+    }
+
+    ImagePoolStats ImageBufferPool::stats() {
+        QMutexLocker locker(&m_mtx);
+        return m_stats;
+    }
+} // namespace qtwrapper
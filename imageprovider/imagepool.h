@@ -0,0 +1,90 @@
+/**
+ * @file imagepool.h
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef __IMAGEPOOL_H__
+#define __IMAGEPOOL_H__
+
+#include <QImage>
+#include <QMutex>
+#include <QList>
+#include <map>
+
+namespace qtwrapper
+{
+    /**
+     * @fn ImagePoolStats
+     * @brief Counters of an ImageBufferPool, a miss is a buffer taken from the system allocator
+     */
+    typedef struct {
+        quint64 hits;
+        quint64 misses;
+        /* Released buffers freed because the pool was full */
+        quint64 discards;
+        qint64 allocatedBytes;
+        qint64 cachedBytes;
+    } ImagePoolStats;
+
+    /**
+     * @fn ImageBufferPool
+     * @brief Pool of aligned pixel buffers for short lived or often replaced images.
+     * Buffers are grouped in size classes (4 per power of two, in pages) so that images of common sizes reuse
+     * the memory of released ones, already faulted in, instead of going through malloc and the kernel.
+     * A pooled QImage gives its buffer back to the pool from its cleanup function. Methods can be called
+     * from any thread.
+     */
+    class ImageBufferPool
+    {
+    private:
+        struct PooledBuffer;
+
+        QMutex m_mtx;
+        std::map<qsizetype, QList<uchar *>> m_free;
+        qint64 m_maxCachedBytes;
+        ImagePoolStats m_stats;
+
+        static void releaseBuffer(void *info);
+        void release(uchar *data, qsizetype bytes);
+
+        ImageBufferPool(const ImageBufferPool &) = delete;
+        ImageBufferPool &operator=(const ImageBufferPool &) = delete;
+
+    public:
+        explicit ImageBufferPool(qint64 maxCachedBytes = 64 * 1024 * 1024);
+        ~ImageBufferPool();
+
+        /**
+         * @fn instance
+         * @brief Process wide pool, never destroyed since pooled images may outlive any owner
+         */
+        static ImageBufferPool *instance();
+
+        /**
+         * @fn allocate
+         * @brief Image with uninitialized pixels backed by a pooled buffer
+         */
+        QImage allocate(const QSize &size, QImage::Format format);
+
+        /**
+         * @fn setMaxCachedBytes
+         * @brief Limit the bytes of released buffers kept for reuse, extra buffers are freed on release
+         */
+        void setMaxCachedBytes(qint64 bytes);
+
+        /**
+         * @fn trim
+         * @brief Free every released buffer
+         */
+        void trim();
+
+        ImagePoolStats stats();
+    };
+} // namespace qtwrapper
+#endif // __IMAGEPOOL_H__
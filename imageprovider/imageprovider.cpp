@@ -10,10 +10,30 @@
  */
 
 #include "imageprovider.h"
+#include "imagecache.h"
+#include "imagepool.h"
+#include "imagemetrics.h"
+#include "compositekernel.h"
+#include "shapemask.h"
+#include "../worker/QWorkerPool.h"
 #include <QPainter>
-#include <QPainterPath>
 #include <QJSValueIterator>
 #include <QReadWriteLock>
+#include <QImageReader>
+#include <QBuffer>
+#include <QFile>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QQuickWindow>
+#include <QSGImageNode>
+#include <QSGTextureProvider>
+#include <QQuickPaintedItem>
+#include <QRunnable>
+#include <QtMath>
+#include <algorithm>
+#include <vector>
+#include <string.h>
 
 namespace qtwrapper
 {
@@ -28,120 +48,1441 @@ namespace qtwrapper
     }
 
     static QReadWriteLock sImageProviderLock;
+
+    static const int sMaxScaledVariants = 4;
+    static const int sLargestEntries = 10;
+    /* Streams publish a first preview once this many bytes arrived, then each time the data doubled,
+     * at 1/sPreviewScale of the final size */
+    static const int sPreviewStep = 64 * 1024;
+    static const int sPreviewScale = 4;
+    static const int sMaxPreviews = 4;
+    /* Generation of the final image of a stream, above every preview */
+    static const quint64 sFinalGeneration = ~0ULL;
+    /* New ids are published in the shared index once they are this fraction of it (or sMinRecentEntries) */
+    static const int sRecentEntriesRatio = 4;
+    static const int sMinRecentEntries = 16;
+    /* Load priority of an OpacityImage inside the window, off screen items get less the further they are */
+    static const int sVisibleLoadPriority = 1000;
+    /* An image which failed to reload is not tried again by fetchImage before this many milliseconds */
+    static const qint64 sReloadRetryInterval = 5000;
+
+    /**
+     * @fn ProviderWriteLocker
+     * @brief QWriteLocker of sImageProviderLock which records the time spent waiting for the lock
+     */
+    class ProviderWriteLocker
+    {
+    private:
+        QReadWriteLock *m_lock;
+
+    public:
+        explicit ProviderWriteLocker(QReadWriteLock *lock) :
+            m_lock(lock) {
+            if (m_lock->tryLockForWrite()) {
+                ImageMetrics::instance()->recordLockWait(0);
+                return;
+            }
+            QElapsedTimer timer;
+            timer.start();
+            m_lock->lockForWrite();
+            ImageMetrics::instance()->recordLockWait(timer.nsecsElapsed() / 1000);
+        }
+
+        ~ProviderWriteLocker() {
+            m_lock->unlock();
+        }
+    };
+
     ImageProvider *ImageProvider::m_instance = NULL;
     int ImageProvider::m_state = -1;
 
+    ImagePrefetch::ImagePrefetch() :
+        m_completed(0),
+        m_loaded(0) {
+    }
+
+    int ImagePrefetch::total() const {
+        return m_tasks.size();
+    }
+
+    int ImagePrefetch::completed() const {
+        return m_completed.load();
+    }
+
+    int ImagePrefetch::loaded() const {
+        return m_loaded.load();
+    }
+
+    bool ImagePrefetch::isDone() const {
+        for (auto &task : m_tasks) {
+            int state = task->State();
+            if (state == TASK_QUEUED || state == TASK_RUNNING) return false;
+        }
+        return true;
+    }
+
+    bool ImagePrefetch::wait(int msecs) {
+        QElapsedTimer timer;
+        timer.start();
+        for (auto &task : m_tasks) {
+            int remaining = -1;
+            if (msecs >= 0) remaining = qMax(0, msecs - static_cast<int>(timer.elapsed()));
+            if (!task->Wait(remaining)) return false;
+        }
+        return true;
+    }
+
+    void ImagePrefetch::cancel() {
+        for (auto &task : m_tasks) task->Cancel();
+    }
+
     /**
      * @fn ImageProvider
      * @brief Construct a new Image Provider:: Image Provider object
      *
      */
     ImageProvider::ImageProvider() :
-        QQuickImageProvider(QQuickImageProvider::Image) {
+        QQuickImageProvider(QQuickImageProvider::Image),
+        m_imagesMap(std::make_shared<ImageIndex>()),
+        m_streams(std::make_shared<FrameStreamMap>()),
+        m_flushScheduled(false),
+        m_decodePool(new QWorkerPool("ImageDecoder")),
+        m_memoryBudget(0),
+        m_residentBytes(0),
+        m_sharedBytes(0),
+        m_pixelDedup(false),
+        m_useClock(0),
+        m_loadSerial(0) {
+    }
+
+    ImageProvider::~ImageProvider() {
+        delete m_decodePool;
+        for (auto p : *m_imagesMap) delete p.second;
+        for (auto p : m_recentEntries) delete p.second;
+    }
+
+    /**
+     * @fn scaledSize
+     * @brief Size of an image fitted into requestedSize, a dimension <= 0 follows the aspect ratio.
+     * Images are never scaled up.
+     */
+    static QSize scaledSize(const QSize &imageSize, const QSize &requestedSize) {
+        QSize target = imageSize;
+        if (imageSize.isEmpty()) return target;
+
+        if (requestedSize.width() > 0 && requestedSize.height() > 0) {
+            target = imageSize.scaled(requestedSize, Qt::KeepAspectRatio);
+        } else if (requestedSize.width() > 0) {
+            target = QSize(requestedSize.width(), qMax(1, imageSize.height() * requestedSize.width() / imageSize.width()));
+        } else if (requestedSize.height() > 0) {
+            target = QSize(qMax(1, imageSize.width() * requestedSize.height() / imageSize.height()), requestedSize.height());
+        }
+
+        if (target.width() >= imageSize.width() || target.height() >= imageSize.height()) return imageSize;
+        return target;
+    }
+
+    static QString resolvePath(const QString &path) {
+        QString file = path;
+        /* Check if the url is passed to remove the qrc:/ prefix */
+        if (file.contains("qrc:/") && file.indexOf("qrc:/") == 0) {
+            file.replace("qrc:/", ":/");
+        }
+        return file;
+    }
+
+    /**
+     * @fn decodeImage
+     * @brief Decode from reader, when maxSize is set the decoder is asked for the fitted size directly
+     * (JPEG decodes at 1/2, 1/4 or 1/8 through DCT scaling, other formats are scaled after decoding).
+     */
+    static bool decodeImage(QImageReader &reader, const QSize &maxSize, QImage &out) {
+        /* Only reads the header */
+        QSize target = reader.size();
+        if (target.isValid() && (maxSize.width() > 0 || maxSize.height() > 0)) {
+            QSize imageSize = target;
+            target = scaledSize(imageSize, maxSize);
+            if (target != imageSize) reader.setScaledSize(target);
+        }
+
+        /* Decoded images live in the store, they get an exact allocation from the reader rather than a pool size class:
+         * the memory budget counts sizeInBytes() and an evicted image gives its memory back to the system */
+        out = QImage();
+
+        QElapsedTimer timer;
+        timer.start();
+        bool ret = reader.read(&out);
+        if (ret) ImageMetrics::instance()->recordDecode(reader.format(), out.size(), timer.nsecsElapsed() / 1000);
+        return ret;
+    }
+
+    /**
+     * @fn decodeData
+     * @brief Decode encoded data, through the disk cache when one is set (keyed by the SHA-1 of the data, only computed then).
+     * With a cache the result is always Format_ARGB32_Premultiplied, as it will be when loaded from the cache.
+     */
+    static bool decodeData(const QByteArray &data, const QSize &maxSize, QImage &out, ImageDiskCache *cache) {
+        const QByteArray hash = cache ? ImageDiskCache::contentHash(data) : QByteArray();
+        if (cache) {
+            out = cache->load(hash, maxSize);
+            if (!out.isNull()) return true;
+        }
+
+        QBuffer buffer;
+        buffer.setData(data);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader reader(&buffer);
+        if (!decodeImage(reader, maxSize, out)) return false;
+
+        if (cache) {
+            out = out.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+            cache->store(hash, maxSize, out);
+        }
+        return true;
+    }
+
+    /**
+     * @fn decodePartial
+     * @brief Decode the part of an image received so far at a reduced size.
+     * Truncated JPEG data decodes with the missing part left gray, the scans of a progressive JPEG already received
+     * give a complete low resolution image. Formats which cannot decode partial data fail until the image is complete.
+     */
+    static bool decodePartial(const QByteArray &data, const QSize &maxSize, QImage &out) {
+        QBuffer buffer;
+        buffer.setData(data);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader reader(&buffer);
+        QSize imageSize = reader.size();
+        if (!imageSize.isValid()) return false;
+
+        QSize target = (maxSize.width() > 0 || maxSize.height() > 0) ? scaledSize(imageSize, maxSize) : imageSize;
+        target = QSize(qMax(1, target.width() / sPreviewScale), qMax(1, target.height() / sPreviewScale));
+        return decodeImage(reader, target, out) && !out.isNull();
+    }
+
+    /**
+     * @fn dataKey
+     * @brief Content key of encoded data decoded to fit in maxSize. Two qHashBits with different seeds and the size
+     * of the data: much cheaper than a cryptographic hash, and 64 (Qt 5) or 128 bits (Qt 6) keep accidental
+     * collisions out of reach.
+     */
+    static QByteArray dataKey(const QByteArray &data, const QSize &maxSize) {
+        const size_t first = qHashBits(data.constData(), data.size(), 0);
+        const size_t second = qHashBits(data.constData(), data.size(), 0x9e3779b9);
+        return "d:" + QByteArray::number(data.size()) + ":" + QByteArray::number((qulonglong)first, 16) + ":" +
+               QByteArray::number((qulonglong)second, 16) + "@" + QByteArray::number(maxSize.width()) + "x" +
+               QByteArray::number(maxSize.height());
+    }
+
+    /**
+     * @fn pixelKey
+     * @brief Content key of decoded pixels. The hash is not collision free, pixel keys are confirmed by comparing the images.
+     */
+    static QByteArray pixelKey(const QImage &image) {
+        if (image.isNull()) return QByteArray();
+        const size_t lineBytes = ((size_t)image.width() * image.depth() + 7) / 8;
+        size_t seed = 0;
+        for (int y = 0; y < image.height(); y++) {
+            seed = qHashBits(image.constScanLine(y), lineBytes, seed);
+        }
+        return "p:" + QByteArray::number((int)image.format()) + ":" + QByteArray::number(image.width()) + "x" +
+               QByteArray::number(image.height()) + ":" + QByteArray::number((qulonglong)seed);
+    }
+
+    /**
+     * @fn findContent
+     * @brief Look for already decoded pixels with the same content key
+     */
+    bool ImageProvider::findContent(const QByteArray &key, QImage &out) {
+        QReadLocker locker(&sImageProviderLock);
+        auto p = m_contents.find(key);
+        if (p == m_contents.end()) return false;
+        out = p->second.image;
+        return true;
+    }
+
+    /**
+     * @fn loadData
+     * @brief Get the image of encoded data, identical data already stored is shared instead of decoded again
+     */
+    bool ImageProvider::loadData(const QByteArray &data, const QSize &maxSize, QImage &out, QByteArray &key) {
+        key = dataKey(data, maxSize);
+        if (findContent(key, out)) return true;
+        return decodeData(data, maxSize, out, std::atomic_load(&m_diskCache).get());
+    }
+
+    bool ImageProvider::loadFile(const QString &file, const QSize &maxSize, QImage &out, QByteArray &key) {
+        /* Hash and decode from a mapping of the file rather than through buffered reads */
+        QFile f(file);
+        key.clear();
+        if (!f.open(QIODevice::ReadOnly)) return false;
+        if (f.size() > 0) {
+            uchar *mapped = f.map(0, f.size());
+            if (mapped) {
+                QByteArray data = QByteArray::fromRawData((const char *)mapped, static_cast<int>(f.size()));
+                bool ret = loadData(data, maxSize, out, key);
+                f.unmap(mapped);
+                return ret;
+            }
+        }
+
+        /* Compressed resources and other unmappable files are read in, they still go through the content key and the disk cache */
+        QByteArray data = f.readAll();
+        return !data.isEmpty() && loadData(data, maxSize, out, key);
+    }
+
+    bool ImageProvider::loadSource(const ImageSource &source, QImage &out, QByteArray &key) {
+        if (!source.image.isNull()) {
+            out = source.image;
+            key = imageKey(out);
+            return true;
+        }
+        if (!source.data.isEmpty()) return loadData(source.data, source.maxSize, out, key);
+        if (!source.path.isEmpty()) return loadFile(resolvePath(source.path), source.maxSize, out, key);
+        return false;
+    }
+
+    /**
+     * @fn sourcePath
+     * @brief File an ImageSource is loaded from, empty if it is loaded from an image or data
+     */
+    static QString sourcePath(const ImageSource &source) {
+        if (!source.image.isNull() || !source.data.isEmpty()) return QString();
+        return resolvePath(source.path);
+    }
+
+    /**
+     * @fn imageKey
+     * @brief Content key of an image committed already decoded, empty unless pixel deduplication is enabled
+     */
+    QByteArray ImageProvider::imageKey(const QImage &image) const {
+        return m_pixelDedup.load(std::memory_order_relaxed) ? pixelKey(image) : QByteArray();
+    }
+
+    void ImageProvider::setPixelDeduplication(bool enabled) {
+        m_pixelDedup = enabled;
+    }
+
+    /**
+     * @fn shareContentLocked
+     * @brief Make an entry share the stored pixels of identical content, must be called with the write lock held.
+     * The bytes are counted when the entry state is published (see countBufferLocked).
+     */
+    void ImageProvider::shareContentLocked(ImageEntry *entry, const QByteArray &key, QImage &image) {
+        if (key.isEmpty() || image.isNull()) return;
+
+        auto p = m_contents.find(key);
+        if (p == m_contents.end()) {
+            SharedContent content;
+            content.image = image;
+            content.refs = 1;
+            m_contents.emplace(key, content);
+        } else if (!key.startsWith("p:") || p->second.image == image) {
+            image = p->second.image;
+            p->second.refs++;
+        } else {
+            /* Pixel hash collision, keep the image unshared */
+            return;
+        }
+        entry->contentKey = key;
+    }
+
+    /**
+     * @fn releaseContentLocked
+     * @brief Drop the reference of an entry on shared pixels, must be called with the write lock held.
+     * The pixels themselves are freed with the previous state of the entry, outside of the lock.
+     */
+    void ImageProvider::releaseContentLocked(ImageEntry *entry) {
+        if (entry->contentKey.isEmpty()) return;
+        auto p = m_contents.find(entry->contentKey);
+        entry->contentKey.clear();
+        if (p == m_contents.end()) return;
+        if (--p->second.refs == 0) m_contents.erase(p);
+    }
+
+    /**
+     * @fn countBufferLocked
+     * @brief Add or remove published references to the pixel buffer of an image, must be called with the write lock held.
+     * A buffer is resident from its first reference to its last one, every other reference is counted in sharedBytes.
+     * Buffers are told apart by QImage data (the serial part of cacheKey), so pixels shared through content keys or
+     * as shallow copies only leave residentBytes once no entry holds them anymore.
+     */
+    void ImageProvider::countBufferLocked(const QImage &image, int refs) {
+        if (image.isNull()) return;
+        const qint64 buffer = image.cacheKey() >> 32;
+        const qint64 bytes = image.sizeInBytes();
+
+        auto p = m_buffers.find(buffer);
+        if (refs > 0) {
+            if (p == m_buffers.end()) {
+                m_buffers.emplace(buffer, 1);
+                m_residentBytes += bytes;
+            } else {
+                p->second++;
+                m_sharedBytes += bytes;
+            }
+            return;
+        }
+
+        if (p == m_buffers.end()) return;
+        if (--p->second > 0) {
+            m_sharedBytes -= bytes;
+            return;
+        }
+        m_residentBytes -= bytes;
+        m_buffers.erase(p);
+    }
+
+    void ImageProvider::countStateLocked(const ImageState &state, int refs) {
+        countBufferLocked(state.image, refs);
+        for (auto &variant : state.variants) countBufferLocked(variant.second, refs);
+    }
+
+    /**
+     * @fn findEntry
+     * @brief Lookup of an entry without the provider lock, an id added since the index was last published
+     * is looked up under the read lock. Must not be called with the lock held (see findEntryLocked).
+     */
+    ImageProvider::ImageEntry *ImageProvider::findEntry(const QString &id) {
+        std::shared_ptr<const ImageIndex> index = std::atomic_load(&m_imagesMap);
+        auto p = index->find(id);
+        if (p != index->end()) return p->second;
+
+        QReadLocker locker(&sImageProviderLock);
+        return findEntryLocked(id);
     }
 
-    ImageProvider::~ImageProvider() {
-        for (auto p : m_imagesMap) delete p.second;
+    /**
+     * @fn findEntryLocked
+     * @brief findEntry with the lock held
+     */
+    ImageProvider::ImageEntry *ImageProvider::findEntryLocked(const QString &id) {
+        auto p = m_imagesMap->find(id);
+        if (p != m_imagesMap->end()) return p->second;
+        p = m_recentEntries.find(id);
+        return p == m_recentEntries.end() ? NULL : p->second;
+    }
+
+    /**
+     * @fn entryLocked
+     * @brief Find or add an entry, must be called with the write lock held. A new id goes to the recent entries,
+     * which are merged into a new copy of the index once they grow to a fraction of it: the copies stay
+     * proportional to the ids added, a batch of new ids copies the index at most once.
+     */
+    ImageProvider::ImageEntry *ImageProvider::entryLocked(const QString &id) {
+        ImageEntry *entry = findEntryLocked(id);
+        if (entry) return entry;
+
+        entry = new ImageEntry();
+        m_recentEntries.emplace(id, entry);
+        const size_t threshold = qMax<size_t>(sMinRecentEntries, m_imagesMap->size() / sRecentEntriesRatio);
+        if (m_recentEntries.size() < threshold) return entry;
+
+        auto index = std::make_shared<ImageIndex>(*m_imagesMap);
+        index->insert(m_recentEntries.begin(), m_recentEntries.end());
+        std::atomic_store(&m_imagesMap, std::shared_ptr<const ImageIndex>(index));
+        m_recentEntries.clear();
+        return entry;
+    }
+
+    /**
+     * @fn publishLocked
+     * @brief Replace the state of an entry and recount its pixel bytes, must be called with the write lock held.
+     * The previous state is moved to "released" to be dropped outside of the lock.
+     */
+    void ImageProvider::publishLocked(ImageEntry *entry, const ImageStatePtr &state, QList<ImageStatePtr> &released) {
+        ImageStatePtr previous = std::atomic_load(&entry->state);
+        std::atomic_store(&entry->state, state);
+
+        /* New references first, pixels kept from the previous state (variants added to the same image) stay resident */
+        if (state) countStateLocked(*state, 1);
+        if (previous) countStateLocked(*previous, -1);
+        released.append(previous);
+    }
+
+    /**
+     * @fn commitLocked
+     * @brief Publish a new image for an entry, must be called with the write lock held
+     */
+    ImageProvider::ImageEntry *ImageProvider::commitLocked(const QString &id, QImage &image, const QByteArray &key, const QString &path, const QSize &maxSize, QList<ImageStatePtr> &released) {
+        ImageEntry *entry = entryLocked(id);
+        releaseContentLocked(entry);
+        shareContentLocked(entry, key, image);
+
+        auto state = std::make_shared<ImageState>();
+        state->image.swap(image);
+        publishLocked(entry, state, released);
+        entry->path = path;
+        entry->maxSize = maxSize;
+        entry->reloadFailedAt = 0;
+        entry->evicted.store(false, std::memory_order_release);
+        touchEntry(entry);
+        return entry;
+    }
+
+    /**
+     * @fn commitImage
+     * @brief Publish an already decoded image in the store.
+     * Only the swap is done under the write lock, the previous image is released outside of the lock.
+     */
+    void ImageProvider::commitImage(const QString &id, QImage &image, const QByteArray &key, const QString &path, const QSize &maxSize) {
+        QList<ImageStatePtr> released;
+        {
+            ProviderWriteLocker locker(&sImageProviderLock);
+            ImageEntry *entry = commitLocked(id, image, key, path, maxSize, released);
+            evictLocked(entry, released);
+        }
+        notifyChanged(QStringList() << id);
+        emit imageChanged(id);
+    }
+
+    /**
+     * @fn commitStreamImage
+     * @brief commitImage for an ImageStream, an image older than the last one committed by the stream is dropped.
+     * The generation is checked under the same lock as the commit so that racing previews cannot reorder.
+     */
+    bool ImageProvider::commitStreamImage(ImageStream *stream, quint64 generation, QImage &image, const QByteArray &key) {
+        QList<ImageStatePtr> released;
+        {
+            ProviderWriteLocker locker(&sImageProviderLock);
+            if (generation <= stream->m_committed) return false;
+            stream->m_committed = generation;
+            ImageEntry *entry = commitLocked(stream->m_id, image, key, QString(), QSize(), released);
+            evictLocked(entry, released);
+        }
+        notifyChanged(QStringList() << stream->m_id);
+        emit imageChanged(stream->m_id);
+        return true;
+    }
+
+    /**
+     * @fn notifyChanged
+     * @brief Mark ids as changed and schedule one flush of the subscribers in the provider thread
+     */
+    void ImageProvider::notifyChanged(const QStringList &ids) {
+        ImageMetrics::instance()->recordNotifications(ids.size());
+        QMutexLocker locker(&m_subscribersMtx);
+        for (auto &id : ids) {
+            if (m_subscribers.find(id) != m_subscribers.end()) m_dirtyIds.insert(id);
+        }
+        if (m_dirtyIds.isEmpty() || m_flushScheduled) return;
+        m_flushScheduled = true;
+        QMetaObject::invokeMethod(this, [this]() { flushNotifications(); }, Qt::QueuedConnection);
+    }
+
+    void ImageProvider::flushNotifications() {
+        QList<ImageSubscriber> subscribers;
+        {
+            QMutexLocker locker(&m_subscribersMtx);
+            for (auto &id : m_dirtyIds) {
+                auto p = m_subscribers.find(id);
+                if (p != m_subscribers.end()) subscribers.append(p->second);
+            }
+            m_dirtyIds.clear();
+            m_flushScheduled = false;
+        }
+
+        for (auto &subscriber : subscribers) {
+            if (subscriber.receiver) subscriber.handler();
+        }
+    }
+
+    void ImageProvider::subscribe(const QString &id, QObject *receiver, std::function<void()> handler) {
+        if (!receiver || !handler) return;
+        ImageSubscriber subscriber;
+        subscriber.receiver = receiver;
+        subscriber.handler = std::move(handler);
+
+        QMutexLocker locker(&m_subscribersMtx);
+        m_subscribers[id].append(subscriber);
+    }
+
+    void ImageProvider::unsubscribe(const QString &id, QObject *receiver) {
+        QMutexLocker locker(&m_subscribersMtx);
+        auto p = m_subscribers.find(id);
+        if (p == m_subscribers.end()) return;
+
+        auto &list = p->second;
+        bool removed = false;
+        for (int i = list.size() - 1; i >= 0; i--) {
+            /* Also drop subscribers destroyed without unsubscribing */
+            if (list[i].receiver.isNull() || (!removed && list[i].receiver == receiver)) {
+                removed = removed || !list[i].receiver.isNull();
+                list.removeAt(i);
+            }
+        }
+        if (list.isEmpty()) m_subscribers.erase(p);
+    }
+
+    /**
+     * @fn loadState
+     * @brief Read of the published state of an image without the provider lock, evicted images are decoded again
+     */
+    ImageProvider::ImageStatePtr ImageProvider::loadState(const QString &id) {
+        ImageEntry *entry = findEntry(id);
+        if (!entry) return NULL;
+
+        touchEntry(entry);
+        ImageStatePtr state = std::atomic_load(&entry->state);
+        if (state) return state;
+        /* evicted is set before a null state is published and cleared after a new state is, an image committed
+         * between the two reads is picked up by reading the state again */
+        if (!entry->evicted.load(std::memory_order_acquire)) return std::atomic_load(&entry->state);
+        return reloadImage(id, entry);
+    }
+
+    /**
+     * @fn reloadImage
+     * @brief Decode again an evicted image, from its file or through the reload handler
+     */
+    ImageProvider::ImageStatePtr ImageProvider::reloadImage(const QString &id, ImageEntry *entry) {
+        QString path;
+        QSize maxSize;
+        ImageReloadHandler handler;
+        {
+            QReadLocker locker(&sImageProviderLock);
+            path = entry->path;
+            maxSize = entry->maxSize;
+            handler = m_reloadHandler;
+        }
+
+        QImage image;
+        QByteArray key;
+        bool loaded = false;
+        if (!path.isEmpty()) {
+            loaded = loadFile(path, maxSize, image, key);
+        } else if (handler) {
+            loaded = handler(id, image);
+            key = imageKey(image);
+        }
+        if (!loaded || image.isNull()) {
+            entry->reloadFailedAt = QDateTime::currentMSecsSinceEpoch();
+            return NULL;
+        }
+        ImageMetrics::instance()->recordReload();
+
+        QList<ImageStatePtr> released;
+        ProviderWriteLocker locker(&sImageProviderLock);
+
+        /* Updated or reloaded by someone else meanwhile */
+        if (!entry->evicted.load()) return std::atomic_load(&entry->state);
+
+        shareContentLocked(entry, key, image);
+        auto state = std::make_shared<ImageState>();
+        state->image = image;
+        publishLocked(entry, state, released);
+        entry->reloadFailedAt = 0;
+        entry->evicted.store(false, std::memory_order_release);
+        touchEntry(entry);
+        evictLocked(entry, released);
+        return state;
+    }
+
+    /**
+     * @fn scheduleLoad
+     * @brief Queue a task loading an id on the decode pool. Every asynchronous load goes through here so that
+     * the items requesting the id with fetchImage can raise its priority while it is queued.
+     */
+    QWorkerTaskPtr ImageProvider::scheduleLoad(const QString &id, int priority, std::function<void()> fnc) {
+        QMutexLocker locker(&m_loadsMtx);
+        return scheduleLoadLocked(id, priority, false, std::move(fnc));
+    }
+
+    QWorkerTaskPtr ImageProvider::scheduleLoadLocked(const QString &id, int priority, bool reload, std::function<void()> fnc) {
+        ImageLoad &load = m_loads[id];
+        dropCanceledLocked(load);
+
+        ImageLoadTask task;
+        task.priority = priority;
+        task.reload = reload;
+        task.serial = ++m_loadSerial;
+        quint64 serial = task.serial;
+        for (auto &request : load.requesters) priority = qMax(priority, request.second);
+        task.queued = priority;
+        /* finishLoad waits for m_loadsMtx, so the task is listed before it can be forgotten */
+        task.task = m_decodePool->Schedule([this, id, serial, fnc]() {
+            fnc();
+            finishLoad(id, serial);
+        }, priority);
+        load.tasks.append(task);
+        return task.task;
+    }
+
+    /**
+     * @fn prioritizeLocked
+     * @brief Requeue the tasks of a load at the highest priority of their requesters, or back at their own
+     */
+    void ImageProvider::prioritizeLocked(ImageLoad &load) {
+        int highest = -1;
+        for (auto &request : load.requesters) highest = qMax(highest, request.second);
+        for (auto &task : load.tasks) {
+            int priority = qMax(task.priority, highest);
+            if (priority == task.queued) continue;
+            task.queued = priority;
+            task.task->SetPriority(priority);
+        }
+    }
+
+    /**
+     * @fn dropCanceledLocked
+     * @brief Forget the canceled tasks of a load (prefetch, AsyncImageProvider), they never reach finishLoad
+     */
+    void ImageProvider::dropCanceledLocked(ImageLoad &load) {
+        for (int i = load.tasks.size() - 1; i >= 0; i--) {
+            if (load.tasks[i].task->State() == TASK_CANCELED) load.tasks.removeAt(i);
+        }
+    }
+
+    /**
+     * @fn finishLoad
+     * @brief Forget a task of m_loads once it has run. The load goes with its last task, its requesters are then
+     * notified whether the image was loaded or not so that they stop waiting for it.
+     */
+    void ImageProvider::finishLoad(const QString &id, quint64 serial) {
+        bool waited = false;
+        {
+            QMutexLocker locker(&m_loadsMtx);
+            auto p = m_loads.find(id);
+            if (p == m_loads.end()) return;
+            auto &tasks = p->second.tasks;
+            for (int i = 0; i < tasks.size(); i++) {
+                if (tasks[i].serial == serial) {
+                    tasks.removeAt(i);
+                    break;
+                }
+            }
+            dropCanceledLocked(p->second);
+            if (!tasks.isEmpty()) return;
+            waited = !p->second.requesters.empty();
+            m_loads.erase(p);
+        }
+        if (waited) notifyChanged(QStringList() << id);
+    }
+
+    void ImageProvider::touchEntry(ImageEntry *entry) {
+        entry->lastUse.store(m_useClock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @fn evictLocked
+     * @brief Evict least recently used images until the memory budget is met, must be called with the write lock held.
+     * Pinned images, images which cannot be reloaded and "keep" are never evicted, evicted states are moved to "released" to be dropped outside of the lock.
+     * Readers still holding a snapshot of an evicted image keep it alive until they release it.
+     */
+    void ImageProvider::evictLocked(const ImageEntry *keep, QList<ImageStatePtr> &released) {
+        if (m_memoryBudget <= 0 || m_residentBytes <= m_memoryBudget) return;
+
+        std::vector<std::pair<quint64, ImageEntry *>> candidates;
+        for (const ImageIndex *index : {m_imagesMap.get(), static_cast<const ImageIndex *>(&m_recentEntries)}) {
+            for (auto &p : *index) {
+                ImageEntry *entry = p.second;
+                if (entry == keep || !std::atomic_load(&entry->state) || entry->pins.load() > 0) continue;
+                /* Without a file or a reload handler it could not be decoded again, keep it like a pinned image */
+                if (entry->path.isEmpty() && !m_reloadHandler) continue;
+                candidates.emplace_back(entry->lastUse.load(std::memory_order_relaxed), entry);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const std::pair<quint64, ImageEntry *> &a, const std::pair<quint64, ImageEntry *> &b) { return a.first < b.first; });
+
+        for (auto &candidate : candidates) {
+            if (m_residentBytes <= m_memoryBudget) break;
+            ImageEntry *entry = candidate.second;
+            /* Flag it first, a reader without the lock seeing the null state must also see it evicted */
+            entry->evicted.store(true, std::memory_order_release);
+            publishLocked(entry, NULL, released);
+            releaseContentLocked(entry);
+        }
+    }
+
+    void ImageProvider::setMemoryBudget(qint64 bytes) {
+        QList<ImageStatePtr> released;
+        ProviderWriteLocker locker(&sImageProviderLock);
+        m_memoryBudget = bytes > 0 ? bytes : 0;
+        evictLocked(NULL, released);
+    }
+
+    qint64 ImageProvider::memoryBudget() {
+        QReadLocker locker(&sImageProviderLock);
+        return m_memoryBudget;
+    }
+
+    qint64 ImageProvider::residentBytes() {
+        QReadLocker locker(&sImageProviderLock);
+        return m_residentBytes;
+    }
+
+    qint64 ImageProvider::sharedBytes() {
+        QReadLocker locker(&sImageProviderLock);
+        return m_sharedBytes;
+    }
+
+    QVariantMap ImageProvider::metrics() {
+        QVariantMap map = ImageMetrics::instance()->toVariantMap();
+
+        /* Largest entries, pixels shared with other ids included */
+        std::vector<QPair<qint64, QString>> sizes;
+        {
+            QReadLocker locker(&sImageProviderLock);
+            for (const ImageIndex *index : {m_imagesMap.get(), static_cast<const ImageIndex *>(&m_recentEntries)}) {
+                for (auto &p : *index) {
+                    ImageStatePtr state = std::atomic_load(&p.second->state);
+                    if (!state) continue;
+                    qint64 bytes = state->image.sizeInBytes();
+                    for (auto &variant : state->variants) bytes += variant.second.sizeInBytes();
+                    sizes.push_back(qMakePair(bytes, p.first));
+                }
+            }
+            map["entries"] = static_cast<int>(m_imagesMap->size() + m_recentEntries.size());
+            map["residentBytes"] = m_residentBytes;
+            map["sharedBytes"] = m_sharedBytes;
+            map["memoryBudget"] = m_memoryBudget;
+        }
+        std::sort(sizes.begin(), sizes.end(), [](const QPair<qint64, QString> &a, const QPair<qint64, QString> &b) {
+            return a.first > b.first;
+        });
+        QVariantList largest;
+        for (size_t i = 0; i < sizes.size() && i < static_cast<size_t>(sLargestEntries); i++) {
+            QVariantMap entry;
+            entry["id"] = sizes[i].second;
+            entry["bytes"] = sizes[i].first;
+            largest.append(entry);
+        }
+        map["largestEntries"] = largest;
+
+        ImagePoolStats pool = ImageBufferPool::instance()->stats();
+        QVariantMap bufferPool;
+        bufferPool["hits"] = static_cast<qulonglong>(pool.hits);
+        bufferPool["misses"] = static_cast<qulonglong>(pool.misses);
+        bufferPool["discards"] = static_cast<qulonglong>(pool.discards);
+        bufferPool["allocatedBytes"] = pool.allocatedBytes;
+        bufferPool["cachedBytes"] = pool.cachedBytes;
+        map["bufferPool"] = bufferPool;
+        map["gradients"] = GradientRegistry::instance()->count();
+
+        ShapeMaskCache *shapes = ShapeMaskCache::instance();
+        QVariantMap shapeMasks;
+        shapeMasks["count"] = shapes->count();
+        shapeMasks["bytes"] = shapes->bytes();
+        shapeMasks["hits"] = shapes->hits();
+        shapeMasks["misses"] = shapes->misses();
+        map["shapeMasks"] = shapeMasks;
+        return map;
+    }
+
+    void ImageProvider::resetMetrics() {
+        ImageMetrics::instance()->reset();
+    }
+
+    void ImageProvider::setDiskCache(const QString &directory, qint64 maxBytes, int maxAgeDays) {
+        std::shared_ptr<ImageDiskCache> cache;
+        if (!directory.isEmpty()) cache = std::make_shared<ImageDiskCache>(directory, maxBytes, maxAgeDays);
+        std::atomic_store(&m_diskCache, cache);
+        if (cache && (maxBytes > 0 || maxAgeDays > 0)) m_decodePool->Submit([cache]() { cache->prune(); });
+    }
+
+    void ImageProvider::setReloadHandler(ImageReloadHandler handler) {
+        ProviderWriteLocker locker(&sImageProviderLock);
+        m_reloadHandler = std::move(handler);
+    }
+
+    void ImageProvider::pinImage(const QString &id) {
+        ProviderWriteLocker locker(&sImageProviderLock);
+        entryLocked(id)->pins++;
+    }
+
+    void ImageProvider::unpinImage(const QString &id) {
+        QList<ImageStatePtr> released;
+        ProviderWriteLocker locker(&sImageProviderLock);
+        ImageEntry *entry = findEntryLocked(id);
+        if (!entry || entry->pins.load() == 0) return;
+        entry->pins--;
+        evictLocked(NULL, released);
+    }
+
+    ImageProvider *ImageProvider::instance() {
+        if (m_state == -1) {
+            m_instance = new ImageProvider();
+            m_state++;
+        }
+        return m_instance;
+    }
+
+    void ImageProvider::destroy() {
+        if (m_state == 0) {
+            delete ImageProvider::m_instance;
+            ImageProvider::m_instance = NULL;
+            m_state++;
+        }
+    }
+
+    ImageSnapshot ImageProvider::image(const QString &id) {
+        FrameStreamPtr stream = frameStream(id);
+        if (stream) return std::make_shared<const QImage>(stream->takeFrame());
+
+        ImageStatePtr state = loadState(id);
+        if (!state) return NULL;
+        /* Shares the ownership of the whole state */
+        return ImageSnapshot(state, &state->image);
+    }
+
+    ImageSnapshot ImageProvider::image(const char *id) {
+        return image(QString(id));
+    }
+
+    QImage ImageProvider::getImage(const QString &id) {
+        FrameStreamPtr stream = frameStream(id);
+        if (stream) return stream->takeFrame();
+
+        ImageStatePtr state = loadState(id);
+        if (!state) return QImage();
+        return state->image;
+    }
+
+    void ImageProvider::updateImage(const char *id, const char *buf, size_t size, const QSize &maxSize) {
+        QImage decoded;
+        QByteArray key;
+        /* Wrap the caller buffer, it is only read during this call */
+        QByteArray data = QByteArray::fromRawData(buf, static_cast<int>(size));
+        if (loadData(data, maxSize, decoded, key)) {
+            commitImage(id, decoded, key);
+        }
+    }
+
+    void ImageProvider::updateImage(const char *id, const QString &path, const QSize &maxSize) {
+        QImage decoded;
+        QByteArray key;
+        QString file = resolvePath(path);
+        if (loadFile(file, maxSize, decoded, key)) {
+            commitImage(id, decoded, key, file, maxSize);
+        }
+    }
+
+    void ImageProvider::updateImage(const char *id, const QImage &image) {
+        QImage img = image;
+        commitImage(id, img, imageKey(img));
+    }
+
+    void ImageProvider::updateImage(const char *id, QImage &&image) {
+        QImage img(std::move(image));
+        commitImage(id, img, imageKey(img));
+    }
+
+    void ImageProvider::updateImage(const char *id, uchar *data, int width, int height, int bytesPerLine, QImage::Format format,
+                                    QImageCleanupFunction cleanupFunction, void *cleanupInfo) {
+        QImage img(data, width, height, bytesPerLine, format, cleanupFunction, cleanupInfo);
+        commitImage(id, img, imageKey(img));
+    }
+
+    static void unmapImageFile(void *info) {
+        delete static_cast<QFile *>(info);
+    }
+
+    /**
+     * @fn mapImageFile
+     * @brief Read-only image over a mapping of raw pixels in a file, unmapped once the last copy of the image is gone
+     */
+    static QImage mapImageFile(const QString &path, int width, int height, int bytesPerLine, QImage::Format format, qint64 offset) {
+        const qint64 bytes = static_cast<qint64>(bytesPerLine) * height;
+        if (width <= 0 || height <= 0 || offset < 0 || format == QImage::Format_Invalid) return QImage();
+        if (bytesPerLine < (static_cast<qint64>(width) * QImage::toPixelFormat(format).bitsPerPixel() + 7) / 8) return QImage();
+
+        QFile *file = new QFile(path);
+        uchar *mapped = NULL;
+        if (file->open(QIODevice::ReadOnly) && file->size() >= offset + bytes) mapped = file->map(offset, bytes);
+        /* The mapping outlives the descriptor, the QFile object is only kept to unmap it */
+        file->close();
+        if (!mapped) {
+            delete file;
+            return QImage();
+        }
+        return QImage(static_cast<const uchar *>(mapped), width, height, bytesPerLine, format, unmapImageFile, file);
+    }
+
+    bool ImageProvider::updateImage(const char *id, const QString &path, int width, int height, int bytesPerLine, QImage::Format format,
+                                    qint64 offset) {
+        QImage img = mapImageFile(resolvePath(path), width, height, bytesPerLine, format, offset);
+        if (img.isNull()) return false;
+        /* Not deduplicated by content, hashing the pixels would read the whole file in */
+        commitImage(id, img, QByteArray());
+        return true;
+    }
+
+    void ImageProvider::updateImageAsync(const char *id, const char *buf, size_t size, const QSize &maxSize, int priority) {
+        QString imageId = id;
+        QByteArray data(buf, static_cast<int>(size));
+        scheduleLoad(imageId, priority, [this, imageId, data, maxSize]() {
+            QImage decoded;
+            QByteArray key;
+            if (loadData(data, maxSize, decoded, key)) {
+                commitImage(imageId, decoded, key);
+            }
+        });
+    }
+
+    void ImageProvider::updateImageAsync(const char *id, const QString &path, const QSize &maxSize, int priority) {
+        QString imageId = id;
+        QString file = resolvePath(path);
+        scheduleLoad(imageId, priority, [this, imageId, file, maxSize]() {
+            QImage decoded;
+            QByteArray key;
+            if (loadFile(file, maxSize, decoded, key)) {
+                commitImage(imageId, decoded, key, file, maxSize);
+            }
+        });
+    }
+
+    int ImageProvider::updateImages(const QList<ImageSource> &items) {
+        std::vector<QImage> decoded(items.size());
+        std::vector<QByteArray> keys(items.size());
+        std::vector<QWorkerTaskPtr> tasks;
+        tasks.reserve(items.size());
+        for (int i = 0; i < items.size(); i++) {
+            tasks.push_back(m_decodePool->Schedule([this, &items, &decoded, &keys, i]() {
+                loadSource(items[i], decoded[i], keys[i]);
+            }));
+        }
+
+        /* Help with the tasks not started yet, this also avoids waiting on a busy pool from one of its threads */
+        for (int i = items.size() - 1; i >= 0; i--) {
+            if (tasks[i]->Cancel()) loadSource(items[i], decoded[i], keys[i]);
+        }
+        for (auto &task : tasks) task->Wait();
+
+        QStringList ids;
+        QList<ImageStatePtr> released;
+        {
+            ProviderWriteLocker locker(&sImageProviderLock);
+            for (int i = 0; i < items.size(); i++) {
+                if (decoded[i].isNull()) continue;
+                const ImageSource &item = items[i];
+                commitLocked(item.id, decoded[i], keys[i], sourcePath(item), item.maxSize, released);
+                ids.append(item.id);
+            }
+            evictLocked(NULL, released);
+        }
+
+        if (!ids.isEmpty()) {
+            notifyChanged(ids);
+            emit imagesChanged(ids);
+        }
+        return ids.size();
+    }
+
+    ImagePrefetchPtr ImageProvider::prefetch(const QList<ImageSource> &items, int priority, ImagePrefetchProgress progress) {
+        auto handle = std::make_shared<ImagePrefetch>();
+        const int total = items.size();
+        for (const ImageSource &item : items) {
+            /* Each image is committed on its own so that it can be shown before the whole set is loaded */
+            handle->m_tasks.append(scheduleLoad(item.id, priority, [this, handle, item, total, progress]() {
+                QImage decoded;
+                QByteArray key;
+                if (loadSource(item, decoded, key) && !decoded.isNull()) {
+                    commitImage(item.id, decoded, key, sourcePath(item), item.maxSize);
+                    handle->m_loaded++;
+                }
+                int completed = ++handle->m_completed;
+                if (progress) progress(completed, total);
+            }, priority));
+        }
+        return handle;
+    }
+
+    ImageStream::ImageStream(ImageProvider *provider, const QString &id, const QSize &maxSize, qint64 expectedSize) :
+        m_provider(provider),
+        m_id(id),
+        m_maxSize(maxSize),
+        m_previewedBytes(0),
+        m_previews(0),
+        m_previewing(false),
+        m_finished(false),
+        m_committed(0) {
+        if (expectedSize > 0) m_data.reserve(static_cast<int>(expectedSize));
+    }
+
+    int ImageStream::append(const char *buf, size_t size) {
+        QMutexLocker locker(&m_mtx);
+        if (m_finished) return -1;
+        if (m_previewing) {
+            m_pending.append(buf, static_cast<int>(size));
+            return 0;
+        }
+        m_data.append(buf, static_cast<int>(size));
+        schedulePreviewLocked();
+        return 0;
+    }
+
+    /**
+     * @fn schedulePreviewLocked
+     * @brief Start a preview decode if enough data arrived since the last one, must be called with m_mtx held
+     */
+    void ImageStream::schedulePreviewLocked() {
+        if (m_finished || m_previewing || m_previews >= sMaxPreviews) return;
+        if (m_data.size() < qMax(sPreviewStep, m_previewedBytes * 2)) return;
+        m_previewing = true;
+        m_previewedBytes = m_data.size();
+        quint64 generation = ++m_previews;
+        auto self = shared_from_this();
+        m_previewTask = m_provider->m_decodePool->Schedule([self, generation]() {
+            self->decodePreview(generation);
+        });
+    }
+
+    void ImageStream::decodePreview(quint64 generation) {
+        /* m_data is not modified while m_previewing is set, read it in place */
+        QImage preview;
+        bool decoded = decodePartial(QByteArray::fromRawData(m_data.constData(), m_data.size()), m_maxSize, preview);
+
+        QMutexLocker locker(&m_mtx);
+        m_data.append(m_pending);
+        m_pending.clear();
+        m_previewing = false;
+        if (m_finished) return;
+
+        /* A newer preview or the final image may be committed while the lock is released, the generation drops this one then */
+        if (decoded) {
+            locker.unlock();
+            m_provider->commitStreamImage(this, generation, preview, QByteArray());
+            locker.relock();
+        }
+        schedulePreviewLocked();
+    }
+
+    int ImageStream::finish() {
+        QWorkerTaskPtr task;
+        {
+            QMutexLocker locker(&m_mtx);
+            if (m_finished) return -1;
+            m_finished = true;
+            task = m_previewTask;
+        }
+        if (task && !task->Cancel()) task->Wait();
+
+        /* No other thread touches the buffers once finished and the preview is done */
+        m_data.append(m_pending);
+        m_pending = QByteArray();
+        QImage decoded;
+        QByteArray key;
+        int ret = -1;
+        if (m_provider->loadData(m_data, m_maxSize, decoded, key)) {
+            m_provider->commitStreamImage(this, sFinalGeneration, decoded, key);
+            ret = 0;
+        }
+        m_data = QByteArray();
+        return ret;
+    }
+
+    void ImageStream::abort() {
+        QWorkerTaskPtr task;
+        {
+            QMutexLocker locker(&m_mtx);
+            if (m_finished) return;
+            m_finished = true;
+            task = m_previewTask;
+        }
+        if (task && !task->Cancel()) task->Wait();
+        m_data = QByteArray();
+        m_pending = QByteArray();
+    }
+
+    FrameStreamPtr ImageProvider::openFrameStream(const QString &id, int frameCount) {
+        ProviderWriteLocker locker(&sImageProviderLock);
+        auto p = m_streams->find(id);
+        if (p != m_streams->end()) return p->second;
+
+        auto stream = std::make_shared<FrameStream>(id, frameCount, [this, id]() {
+            notifyChanged(QStringList() << id);
+        });
+        auto streams = std::make_shared<FrameStreamMap>(*m_streams);
+        streams->emplace(id, stream);
+        std::atomic_store(&m_streams, std::shared_ptr<const FrameStreamMap>(streams));
+        return stream;
+    }
+
+    FrameStreamPtr ImageProvider::frameStream(const QString &id) {
+        std::shared_ptr<const FrameStreamMap> streams = std::atomic_load(&m_streams);
+        if (streams->empty()) return NULL;
+        auto p = streams->find(id);
+        if (p == streams->end()) return NULL;
+        return p->second;
+    }
+
+    void ImageProvider::closeFrameStream(const QString &id) {
+        {
+            ProviderWriteLocker locker(&sImageProviderLock);
+            if (m_streams->find(id) == m_streams->end()) return;
+            auto streams = std::make_shared<FrameStreamMap>(*m_streams);
+            streams->erase(id);
+            std::atomic_store(&m_streams, std::shared_ptr<const FrameStreamMap>(streams));
+        }
+        notifyChanged(QStringList() << id);
+    }
+
+    ImageStreamPtr ImageProvider::openStream(const QString &id, const QSize &maxSize, qint64 expectedSize) {
+        /* The constructor is private to ImageStream, std::make_shared cannot reach it */
+        return ImageStreamPtr(new ImageStream(this, id, maxSize, expectedSize));
+    }
+
+    int ImageProvider::fetchImage(const QString &id, const void *requester, int priority, ImageSnapshot &snapshot) {
+        snapshot = NULL;
+        FrameStreamPtr stream = frameStream(id);
+        if (stream) {
+            snapshot = std::make_shared<const QImage>(stream->takeFrame());
+            return snapshot->isNull() ? -1 : 1;
+        }
+
+        ImageEntry *entry = findEntry(id);
+        ImageStatePtr state;
+        bool evicted = false;
+        if (entry) {
+            /* Same read order as loadState */
+            state = std::atomic_load(&entry->state);
+            if (!state) evicted = entry->evicted.load(std::memory_order_acquire);
+            if (!state && !evicted) state = std::atomic_load(&entry->state);
+        }
+        if (state || priority < 0) {
+            cancelFetch(id, requester);
+            if (!state) return -1;
+            touchEntry(entry);
+            snapshot = ImageSnapshot(state, &state->image);
+            return 1;
+        }
+
+        QMutexLocker locker(&m_loadsMtx);
+        auto p = m_loads.find(id);
+        if (p != m_loads.end()) {
+            dropCanceledLocked(p->second);
+            if (p->second.tasks.isEmpty()) {
+                m_loads.erase(p);
+                p = m_loads.end();
+            }
+        }
+
+        if (p == m_loads.end()) {
+            /* Not loaded nor being loaded, or failed to reload a moment ago */
+            const qint64 failedAt = entry ? entry->reloadFailedAt.load() : 0;
+            if (!evicted || (failedAt > 0 && QDateTime::currentMSecsSinceEpoch() - failedAt < sReloadRetryInterval)) return -1;
+
+            m_loads[id].requesters[requester] = priority;
+            scheduleLoadLocked(id, priority, true, [this, id, entry]() {
+                if (reloadImage(id, entry)) notifyChanged(QStringList() << id);
+            });
+            return 0;
+        }
+
+        ImageLoad &load = p->second;
+        load.requesters[requester] = priority;
+        prioritizeLocked(load);
+        return 0;
     }
 
-    ImageProvider *ImageProvider::instance() {
-        if (m_state == -1) {
-            m_instance = new ImageProvider();
-            m_state++;
+    void ImageProvider::cancelFetch(const QString &id, const void *requester) {
+        QList<QWorkerTaskPtr> canceled;
+        {
+            QMutexLocker locker(&m_loadsMtx);
+            auto p = m_loads.find(id);
+            if (p == m_loads.end()) return;
+            ImageLoad &load = p->second;
+            if (!load.requesters.erase(requester)) return;
+
+            if (load.requesters.empty()) {
+                /* Reloads only exist for their requesters, other loads go back to their own priority */
+                for (int i = load.tasks.size() - 1; i >= 0; i--) {
+                    if (!load.tasks[i].reload) continue;
+                    canceled.append(load.tasks[i].task);
+                    load.tasks.removeAt(i);
+                }
+                if (load.tasks.isEmpty()) {
+                    m_loads.erase(p);
+                } else {
+                    prioritizeLocked(load);
+                }
+            } else {
+                prioritizeLocked(load);
+            }
         }
-        return m_instance;
+        /* Deleting a canceled task destroys its closure, keep it out of the lock */
+        for (auto &task : canceled) task->Cancel();
     }
 
-    void ImageProvider::destroy() {
-        if (m_state == 0) {
-            delete ImageProvider::m_instance;
-            ImageProvider::m_instance = NULL;
-            m_state++;
+    QImage ImageProvider::requestImage(const QString &id, QSize *size, const QSize &requestedSize) {
+        FrameStreamPtr stream = frameStream(id);
+        if (stream) {
+            QImage frame = stream->takeFrame();
+            if (size) { *size = frame.size(); }
+            return frame;
+        }
+
+        ImageStatePtr state = loadState(id);
+        if (!state) {
+            ImageMetrics::instance()->recordRequest(false);
+            return QImage();
+        }
+
+        const QImage &image = state->image;
+        if (size) { *size = image.size(); }
+
+        QSize target = scaledSize(image.size(), requestedSize);
+        for (auto &variant : state->variants) {
+            if (variant.first != target) continue;
+            ImageMetrics::instance()->recordRequest(true);
+            return variant.second;
+        }
+        ImageMetrics::instance()->recordRequest(target == image.size());
+        if (target == image.size()) return image;
+
+        /* Scale outside of the lock, then publish the variant if the image was not updated meanwhile */
+        QImage scaled = image.scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        QList<ImageStatePtr> released;
+        {
+            ProviderWriteLocker locker(&sImageProviderLock);
+            ImageEntry *entry = findEntryLocked(id);
+            ImageStatePtr current = std::atomic_load(&entry->state);
+            if (!current || current->image.cacheKey() != image.cacheKey()) return scaled;
+
+            for (auto &variant : current->variants) {
+                if (variant.first == target) return variant.second;
+            }
+
+            auto next = std::make_shared<ImageState>(*current);
+            if (next->variants.size() >= sMaxScaledVariants) next->variants.removeFirst();
+            next->variants.append(qMakePair(target, scaled));
+            publishLocked(entry, next, released);
+            evictLocked(entry, released);
         }
+        return scaled;
     }
 
-    QImage *ImageProvider::image(const QString &id) {
-        auto p = m_imagesMap.find(id);
-        if (p == m_imagesMap.end()) return NULL;
-        return m_imagesMap[id];
+    /**
+     * @fn ImageResponse
+     * @brief Construct a new Image Response:: Image Response object
+     *
+     */
+    ImageResponse::ImageResponse(AsyncImageProvider *provider, const QString &key) :
+        m_provider(provider),
+        m_key(key) {
     }
 
-    QImage *ImageProvider::image(const char *id) {
-        QString imageId = id;
-        auto p = m_imagesMap.find(imageId);
-        if (p == m_imagesMap.end()) return NULL;
-        return m_imagesMap[imageId];
+    void ImageResponse::complete(const QImage &image, const QString &error) {
+        m_provider = NULL;
+        m_image = image;
+        m_errorString = error;
+        emit finished();
     }
 
-    QImage ImageProvider::getImage(const QString &id) {
-        QReadLocker locker(&sImageProviderLock);
-        auto p = m_imagesMap.find(id);
-        if (p == m_imagesMap.end()) return QImage();
-        return *m_imagesMap[id];
+    QQuickTextureFactory *ImageResponse::textureFactory() const {
+        return QQuickTextureFactory::textureFactoryForImage(m_image);
     }
 
-    void ImageProvider::updateImage(const char *id, const char *buf, size_t size) {
-        QWriteLocker locker(&sImageProviderLock);
-        auto img = this->image(id);
-        if (img == NULL) {
-            m_imagesMap[id] = new QImage();
-            img = m_imagesMap[id];
-        }
-        img->loadFromData((const uchar *)buf, size);
-        emit imageChanged(id);
+    QString ImageResponse::errorString() const {
+        return m_errorString;
     }
 
-    void ImageProvider::updateImage(const char *id, const QString &path) {
-        QWriteLocker locker(&sImageProviderLock);
-        QString file = path;
-        auto img = this->image(id);
-        if (img == NULL) {
-            m_imagesMap[id] = new QImage();
-            img = m_imagesMap[id];
+    void ImageResponse::cancel() {
+        /* A canceled response still has to emit finished so the engine can delete it.
+         * If the job already took this response it will emit finished itself. */
+        AsyncImageProvider *provider = m_provider.load();
+        if (provider && provider->cancelResponse(this)) {
+            complete(QImage(), "Canceled");
         }
+    }
 
-        /* Check if the url is passed to remove the qrc:/ prefix */
-        if (file.contains("qrc:/") && file.indexOf("qrc:/") == 0) {
-            file.replace("qrc:/", ":/");
+    /**
+     * @fn AsyncImageProvider
+     * @brief Construct a new Async Image Provider:: Async Image Provider object
+     *
+     */
+    AsyncImageProvider::AsyncImageProvider() {
+    }
+
+    AsyncImageProvider::~AsyncImageProvider() {
+        std::map<QString, RequestJob> jobs;
+        {
+            QMutexLocker locker(&m_jobsMtx);
+            jobs.swap(m_jobs);
         }
 
-        if (img->load(file)) {
-            emit imageChanged(id);
+        for (auto &p : jobs) {
+            if (p.second.task) {
+                p.second.task->Cancel();
+                p.second.task->Wait();
+            }
+            for (auto response : p.second.responses) {
+                response->complete(QImage(), "Image provider destroyed");
+            }
         }
     }
 
-    void ImageProvider::updateImage(const char *id, const QImage &image) {
-        QWriteLocker locker(&sImageProviderLock);
-        auto img = this->image(id);
-        if (img == NULL) {
-            m_imagesMap[id] = new QImage();
-            img = m_imagesMap[id];
+    QQuickImageResponse *AsyncImageProvider::requestImageResponse(const QString &id, const QSize &requestedSize) {
+        QString key = id;
+        if (requestedSize.width() > 0 || requestedSize.height() > 0) {
+            key += QString("@%1x%2").arg(requestedSize.width()).arg(requestedSize.height());
         }
-        *img = image;
-        emit imageChanged(id);
+        auto response = new ImageResponse(this, key);
+
+        QMutexLocker locker(&m_jobsMtx);
+        auto p = m_jobs.find(key);
+        if (p != m_jobs.end()) {
+            p->second.responses.append(response);
+            return response;
+        }
+
+        RequestJob &job = m_jobs[key];
+        job.responses.append(response);
+        job.task = ImageProvider::instance()->scheduleLoad(id, 0, [this, key, id, requestedSize]() {
+            runJob(key, id, requestedSize);
+        });
+        return response;
     }
 
-    QImage ImageProvider::requestImage(const QString &id, QSize *size, const QSize &requestedSize) {
-        Q_UNUSED(requestedSize)
-        QReadLocker locker(&sImageProviderLock);
+    void AsyncImageProvider::runJob(const QString &key, const QString &id, const QSize &requestedSize) {
+        QSize size;
+        QImage image = ImageProvider::instance()->requestImage(id, &size, requestedSize);
+        QList<ImageResponse *> responses;
+        {
+            QMutexLocker locker(&m_jobsMtx);
+            auto p = m_jobs.find(key);
+            /* Every response was canceled while the job was running */
+            if (p == m_jobs.end()) return;
+            responses.swap(p->second.responses);
+            m_jobs.erase(p);
+        }
 
-        auto p = m_imagesMap.find(id);
-        if (p == m_imagesMap.end()) return QImage();
+        QString error = image.isNull() ? QString("Image \"%1\" not found").arg(id) : QString();
+        for (auto response : responses) {
+            response->complete(image, error);
+        }
+    }
 
-        QImage *image = p->second;
-        if (size) { *size = QSize(image->width(), image->height()); }
+    bool AsyncImageProvider::cancelResponse(ImageResponse *response) {
+        std::shared_ptr<QWorkerTask> task;
+        {
+            QMutexLocker locker(&m_jobsMtx);
+            auto p = m_jobs.find(response->m_key);
+            if (p == m_jobs.end()) return false;
+            if (!p->second.responses.removeOne(response)) return false;
+            if (p->second.responses.isEmpty()) {
+                task = p->second.task;
+                m_jobs.erase(p);
+            }
+        }
 
-        return *image;
+        /* If the job is already running it finds no entry and drops its result */
+        if (task) task->Cancel();
+        return true;
     }
 
     /**
-     * @fn OpacityImage
-     * @brief Construct a new Opacity Image:: Opacity Image object
+     * @fn OpacityImageBase
+     * @brief Construct a new Opacity Image Base:: Opacity Image Base object
      *
      */
-    OpacityImage::OpacityImage() :
+    OpacityImageBase::OpacityImageBase() :
         m_source(""),
         m_image(NULL),
+        m_loadPriority(-1),
+        m_renderer(std::make_shared<OpacityRenderer>(this)),
+        m_asynchronous(false),
         m_radius(0),
         m_resizemode(ResizeMode::Fit),
         m_gradient(NULL),
@@ -151,153 +1492,577 @@ namespace qtwrapper
         m_yMirror(false),
         m_url("") {
 
-        QObject::connect(
-            ImageProvider::instance(), &ImageProvider::imageChanged, this, [this](const QString id) {
-                if (id == getSource()) {
-                    m_image = ImageProvider::instance()->getImage(getSource());
-                    update();
-                }
-            },
-            Qt::QueuedConnection);
+        /* A new size composes the item again, the setters below do the same for their property */
+        QObject::connect(this, &QQuickItem::widthChanged, this, &QQuickItem::polish);
+        QObject::connect(this, &QQuickItem::heightChanged, this, &QQuickItem::polish);
+
+        QObject::connect(this, &OpacityImageBase::sourceChanged, this, [this]() {
+            /* Keep the displayed image resident in the provider and only listen to its updates */
+            auto provider = ImageProvider::instance();
+            if (!m_pinnedSource.isEmpty()) {
+                provider->unpinImage(m_pinnedSource);
+                provider->unsubscribe(m_pinnedSource, this);
+                provider->cancelFetch(m_pinnedSource, this);
+            }
+            m_pinnedSource = getSource();
+            if (!m_pinnedSource.isEmpty()) {
+                provider->pinImage(m_pinnedSource);
+                provider->subscribe(m_pinnedSource, this, [this]() {
+                    refreshImage();
+                });
+            }
 
-        QObject::connect(this, &OpacityImage::sourceChanged, this, [this]() {
-            m_image = ImageProvider::instance()->getImage(getSource());
-            update();
+            m_image = QImage();
+            refreshImage();
         });
 
-        QObject::connect(this, &OpacityImage::urlChanged, this, [this]() {
+        QObject::connect(this, &OpacityImageBase::urlChanged, this, [this]() {
             QString url = getURL();
             if (url.contains("qrc:/") && url.indexOf("qrc:/") == 0) {
                 url.replace("qrc:/", ":/");
             }
             m_image = QImage(url);
-            update();
+            polish();
         });
     }
 
-    OpacityImage::~OpacityImage() {
+    OpacityImageBase::~OpacityImageBase() {
+        m_renderer->detach();
+        if (!m_pinnedSource.isEmpty()) {
+            ImageProvider::instance()->unpinImage(m_pinnedSource);
+            ImageProvider::instance()->unsubscribe(m_pinnedSource, this);
+            ImageProvider::instance()->cancelFetch(m_pinnedSource, this);
+        }
     }
 
-    void OpacityImage::paint(QPainter *painter) {
+    /**
+     * @fn loadPriority
+     * @brief Priority of the source image load from the position of the item in its window, -1 if it is not shown
+     */
+    int OpacityImageBase::loadPriority() {
+        QQuickWindow *win = window();
+        if (!win || !isVisible()) return -1;
 
-        if (m_image.isNull()) return;
+        const QRectF view(QPointF(0, 0), QSizeF(win->size()));
+        const QRectF rect = mapRectToScene(QRectF(0, 0, width(), height()));
+        if (rect.intersects(view) || view.contains(rect.center())) return sVisibleLoadPriority;
 
-        QPainterPath borderPath;
-        const qreal radius = this->getRadius();
-        const QSizeF dSize = boundingRect().size();
-        QColor borderColor(getBorderColor());
-        QPen pen(borderColor);
+        /* Distance to the viewport in viewport lengths, one step per tenth of a viewport */
+        qreal dx = qMax(qMax(view.left() - rect.right(), rect.left() - view.right()), 0.0) / qMax(view.width(), 1.0);
+        qreal dy = qMax(qMax(view.top() - rect.bottom(), rect.top() - view.bottom()), 0.0) / qMax(view.height(), 1.0);
+        return qMax(0, sVisibleLoadPriority - 1 - static_cast<int>(qMax(dx, dy) * 10));
+    }
 
-        /* set the default value */
-        if (m_gradient) {
-            if (m_gradient->type() == QGradient::LinearGradient) {
-                if (m_linearGradient.start() == QPointF(0, 0) && m_linearGradient.finalStop() == QPointF(0, 0)) {
-                    m_linearGradient.setStart(QPointF(0, 0));
-                    m_linearGradient.setFinalStop(QPointF(0, height()));
-                }
-            } else if (m_gradient->type() == QGradient::RadialGradient) {
-            } else if (m_gradient->type() == QGradient::ConicalGradient) {
+    /**
+     * @fn refreshImage
+     * @brief Take the source image from the provider without blocking. An evicted image is reloaded on the
+     * decode pool, its priority (like the one of a pending updateImageAsync or prefetch of the id) follows the
+     * item every frame until the load is over, and a reload is canceled once hidden.
+     */
+    void OpacityImageBase::refreshImage() {
+        ImageSnapshot snapshot;
+        int priority = loadPriority();
+        int ret = -1;
+        if (!getSource().isEmpty()) ret = ImageProvider::instance()->fetchImage(getSource(), this, priority, snapshot);
+
+        if (ret == 0) {
+            m_loadPriority = priority;
+            if (!m_frameConnection && window()) {
+                m_frameConnection = QObject::connect(window(), &QQuickWindow::afterAnimating, this, [this]() {
+                    if (loadPriority() != m_loadPriority) refreshImage();
+                });
             }
+            return;
         }
 
-        switch (m_resizemode) {
-        case ResizeMode::Scaled: {
-            m_image = m_image.scaled(dSize.width(), dSize.height(), Qt::KeepAspectRatioByExpanding);
-        } break;
-        case ResizeMode::Fit: {
-            m_image = m_image.scaled(dSize.width(), dSize.height(), Qt::IgnoreAspectRatio);
+        m_loadPriority = -1;
+        if (m_frameConnection) {
+            QObject::disconnect(m_frameConnection);
+            m_frameConnection = QMetaObject::Connection();
+        }
+        m_image = snapshot ? *snapshot : QImage();
+        polish();
+    }
+
+    void OpacityImageBase::itemChange(ItemChange change, const ItemChangeData &value) {
+        QQuickItem::itemChange(change, value);
+        if (change != ItemSceneChange && change != ItemVisibleHasChanged) return;
+
+        /* Follow another window, or start / cancel the load of an image not shown yet */
+        if (change == ItemSceneChange && m_frameConnection) {
+            QObject::disconnect(m_frameConnection);
+            m_frameConnection = QMetaObject::Connection();
+        }
+        if (m_loadPriority >= 0 || m_image.isNull()) refreshImage();
+    }
+
+    QImage OpacityImageBase::renderedImage(const QSize &size, qreal scale, QRect *dirty) {
+        OpacityInputs inputs;
+        inputs.image = m_image;
+        inputs.size = size;
+        inputs.resizeMode = m_resizemode;
+        inputs.xMirror = m_xMirror;
+        inputs.yMirror = m_yMirror;
+        inputs.gradient = m_gradient;
+        inputs.radius = m_radius * scale;
+        inputs.border = getBorder() * scale;
+        inputs.borderColor = QColor(m_borderColor).rgba();
+        inputs.scale = scale;
+        if (!m_asynchronous) {
+            QRect rect = m_renderer->render(inputs);
+            if (dirty) *dirty = rect;
+        } else {
+            m_renderer->renderAsync(inputs, qMax(0, loadPriority()));
+            if (dirty) *dirty = QRect();
+        }
+        return m_renderer->front();
+    }
+
+    /**
+     * @fn OpacityImagePainter
+     * @brief Painted child of an OpacityImage filling it, draws the front image of the renderer
+     */
+    class OpacityImagePainter : public QQuickPaintedItem
+    {
+    private:
+        std::shared_ptr<OpacityRenderer> m_renderer;
+
+    public:
+        OpacityImagePainter(QQuickItem *parent, const std::shared_ptr<OpacityRenderer> &renderer) :
+            QQuickPaintedItem(parent),
+            m_renderer(renderer) {
+        }
+
+        /**
+         * @fn paint
+         * @brief Draw the composed image, only the part being repainted (the clip) when the item updates a rect
+         */
+        void paint(QPainter *painter) override {
+            QImage image = m_renderer->front();
+            if (image.isNull()) return;
+
+            QRect rect = image.rect();
+            if (painter->hasClipping()) rect = rect.intersected(painter->clipBoundingRect().toAlignedRect());
+            if (rect.isEmpty()) return;
+
+            painter->save();
+            painter->setCompositionMode(QPainter::CompositionMode_Source);
+            painter->drawImage(rect.topLeft(), image, rect);
+            painter->restore();
+        }
+    };
+
+    OpacityImage::OpacityImage() :
+        OpacityImageBase(),
+        m_painter(new OpacityImagePainter(this, renderer())) {
+        m_painter->setSize(size());
+        QObject::connect(this, &QQuickItem::widthChanged, m_painter, [this]() { m_painter->setWidth(width()); });
+        QObject::connect(this, &QQuickItem::heightChanged, m_painter, [this]() { m_painter->setHeight(height()); });
+    }
+
+    void OpacityImage::updatePolish() {
+        QRect dirty;
+        renderedImage(QSize(qCeil(width()), qCeil(height())), 1, &dirty);
+        if (!dirty.isEmpty()) updateContent(dirty);
+    }
+
+    void OpacityImage::updateContent(const QRect &dirty) {
+        m_painter->update(dirty);
+    }
+
+    static bool sameInputs(const OpacityInputs &a, const OpacityInputs &b) {
+        return a.image.cacheKey() == b.image.cacheKey() && a.size == b.size && a.resizeMode == b.resizeMode &&
+               a.xMirror == b.xMirror && a.yMirror == b.yMirror && a.gradient == b.gradient && a.radius == b.radius &&
+               a.border == b.border && a.borderColor == b.borderColor && a.scale == b.scale;
+    }
+
+    /**
+     * @fn compositionPool
+     * @brief Pool of asynchronous OpacityImage compositions, apart from the decoders
+     */
+    static QWorkerPool *compositionPool() {
+        static QWorkerPool pool("OpacityComposer");
+        return &pool;
+    }
+
+    OpacityRenderer::OpacityRenderer(OpacityImageBase *item) :
+        m_preparedKey(0),
+        m_preparedMode(OpacityImageBase::ResizeMode::Fit),
+        m_preparedScale(1),
+        m_preparedXMirror(false),
+        m_preparedYMirror(false),
+        m_preparedChanges(),
+        m_compositedMaskKey(0),
+        m_compositedImageKey(0),
+        m_compositedChanges(),
+        m_shapedImageKey(0),
+        m_shapedBorderColor(0),
+        m_shapedChanges(),
+        m_item(item),
+        m_requested(),
+        m_hasRequested(false),
+        m_pending(),
+        m_hasPending(false),
+        m_running(false) {
+    }
+
+    void OpacityRenderer::detach() {
+        QMutexLocker locker(&m_mtx);
+        m_item = NULL;
+    }
+
+    QRect OpacityRenderer::render(const OpacityInputs &inputs) {
+        QMutexLocker composeLocker(&m_composeMtx);
+        TileChanges changes;
+        QImage image = composeLocked(inputs, changes);
+        QMutexLocker locker(&m_mtx);
+        return publishLocked(image, changes, inputs.scale);
+    }
+
+    /**
+     * @fn renderAsync
+     * @brief The composition of new inputs runs on the composition pool. A single job runs per item: inputs changing
+     * while it runs replace the pending ones instead of queuing another job, the job takes the latest when it is done.
+     */
+    void OpacityRenderer::renderAsync(const OpacityInputs &inputs, int priority) {
+        QMutexLocker locker(&m_mtx);
+        if (m_hasRequested && sameInputs(m_requested, inputs)) return;
+        m_requested = inputs;
+        m_hasRequested = true;
+        if (m_running) {
+            m_pending = inputs;
+            m_hasPending = true;
+            return;
+        }
+
+        m_running = true;
+        auto self = shared_from_this();
+        compositionPool()->Submit([self, inputs]() {
+            self->run(inputs);
+        }, priority);
+    }
+
+    QImage OpacityRenderer::front() {
+        QMutexLocker locker(&m_mtx);
+        return m_front;
+    }
+
+    void OpacityRenderer::run(const OpacityInputs &first) {
+        OpacityInputs inputs = first;
+        while (true) {
+            /* Composed into the back buffers of the steps, the front image stays untouched until it is replaced */
+            TileChanges changes;
+            QImage image;
+            {
+                QMutexLocker locker(&m_composeMtx);
+                image = composeLocked(inputs, changes);
+            }
+
+            QMutexLocker locker(&m_mtx);
+            const QRect dirty = publishLocked(image, changes, inputs.scale);
+            if (m_item && !dirty.isEmpty()) {
+                OpacityImageBase *item = m_item;
+                QMetaObject::invokeMethod(item, [item, dirty]() { item->updateContent(dirty); }, Qt::QueuedConnection);
+            }
+            if (!m_hasPending) {
+                m_running = false;
+                return;
+            }
+            inputs = m_pending;
+            m_pending = OpacityInputs();
+            m_hasPending = false;
+        }
+    }
+
+    /**
+     * @fn publishLocked
+     * @brief Make "image" the front image, must be called with m_mtx held. The part to repaint is the tiles of
+     * "changes" when they were computed from the current front, the whole item otherwise.
+     */
+    QRect OpacityRenderer::publishLocked(const QImage &image, const TileChanges &changes, qreal scale) {
+        QRect dirty;
+        if (image.isNull() && m_front.isNull()) return dirty;
+        if (!image.isNull() && image.cacheKey() == m_front.cacheKey()) return dirty;
+
+        if (!image.isNull() && !m_front.isNull() && image.size() == m_front.size() && changes.fromKey == m_front.cacheKey() &&
+            changes.toKey == image.cacheKey()) {
+            dirty = changes.tiles.dirtyBounds();
+        } else {
+            dirty = image.rect().united(m_front.rect());
+        }
+        m_front = image;
+        if (scale == 1 || dirty.isNull()) return dirty;
+        return QRectF(dirty.x() / scale, dirty.y() / scale, dirty.width() / scale, dirty.height() / scale).toAlignedRect();
+    }
+
+    /**
+     * @fn composeLocked
+     * @brief The image of the item for these inputs, must be called with m_composeMtx held.
+     * "changes" are the tiles which changed from the previous image of the last step.
+     */
+    QImage OpacityRenderer::composeLocked(const OpacityInputs &inputs, TileChanges &changes) {
+        if (inputs.image.isNull() || inputs.size.isEmpty()) {
+            changes = TileChanges();
+            return QImage();
+        }
+
+        const QImage *image = &preparedImage(inputs);
+        const TileChanges *imageChanges = &m_preparedChanges;
+        if (inputs.gradient) {
+            image = &compositedImage(inputs, *image);
+            imageChanges = &m_compositedChanges;
+        }
+        /* The gradient tint, the rounded rect and the border are part of the cached image, an unchanged item is a single blit */
+        const QImage &shaped = shapedImage(inputs, *image, *imageChanges);
+        changes = (shaped.cacheKey() == image->cacheKey()) ? *imageChanges : m_shapedChanges;
+        return shaped;
+    }
+
+    /**
+     * @fn inheritChanges
+     * @brief Tiles of "image" to compute again for a step last computed from the version "fromKey" of it:
+     * the tiles the previous step changed from that version, all of them if it is another version.
+     */
+    static void inheritChanges(TileGrid &dirty, const TileChanges &changes, qint64 fromKey, const QImage &image) {
+        if (changes.fromKey == fromKey && changes.toKey == image.cacheKey()) {
+            dirty.merge(changes.tiles);
+        } else {
+            dirty.markAll();
+        }
+    }
+
+    /**
+     * @fn preparedImage
+     * @brief The source image scaled to the item, mirrored and premultiplied, ready to be drawn.
+     * It is computed again only when the source, the size, the resize mode or the mirror flags change,
+     * the source is kept as it came from the provider.
+     */
+    const QImage &OpacityRenderer::preparedImage(const OpacityInputs &inputs) {
+        const QSize &size = inputs.size;
+        if (!m_prepared.isNull() && m_preparedKey == inputs.image.cacheKey() && m_preparedSize == size &&
+            m_preparedMode == inputs.resizeMode && m_preparedScale == inputs.scale && m_preparedXMirror == inputs.xMirror &&
+            m_preparedYMirror == inputs.yMirror) {
+            return m_prepared;
+        }
+
+        QImage image;
+        switch (inputs.resizeMode) {
+        case OpacityImageBase::ResizeMode::Scaled: {
+            image = inputs.image.scaled(size, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
         } break;
-        case ResizeMode::Fixed: {
+        case OpacityImageBase::ResizeMode::Fixed: {
+            /* One image pixel per item unit */
+            image = (inputs.scale == 1) ? inputs.image
+                                        : inputs.image.scaled(inputs.image.size() * inputs.scale, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
         } break;
+        case OpacityImageBase::ResizeMode::Fit:
         default:
-            m_image = m_image.scaled(dSize.width(), dSize.height(), Qt::IgnoreAspectRatio);
+            image = inputs.image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
             break;
         }
 
-        if (getxMirror() || getyMirror()) {
-            m_image.mirror(getyMirror(), getxMirror());
+        if (inputs.xMirror || inputs.yMirror) {
+            image = image.mirrored(inputs.yMirror, inputs.xMirror);
         }
 
-        painter->save();
-        painter->setRenderHint(QPainter::Antialiasing, true);
-        borderPath.addRoundedRect(QRectF(QPointF(0, 0), dSize), radius, radius);
-        painter->setClipPath(borderPath, Qt::IntersectClip);
-        painter->setCompositionMode(QPainter::CompositionMode_Source);
+        /* Premultiplied (or opaque) pixels are blended without conversion at each paint */
+        QImage::Format format = image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+        if (image.format() != format) image = image.convertToFormat(format);
+
+        /* A new frame of the same source often differs by a few tiles only */
+        m_preparedChanges.fromKey = m_prepared.cacheKey();
+        m_preparedChanges.toKey = image.cacheKey();
+        m_preparedChanges.tiles.reset(size);
+        m_preparedChanges.tiles.markChanged(m_prepared, image);
+
+        m_prepared = image;
+        m_preparedKey = inputs.image.cacheKey();
+        m_preparedSize = size;
+        m_preparedMode = inputs.resizeMode;
+        m_preparedScale = inputs.scale;
+        m_preparedXMirror = inputs.xMirror;
+        m_preparedYMirror = inputs.yMirror;
+        return m_prepared;
+    }
+
+    /**
+     * @fn opacityMask
+     * @brief Alpha mask of the gradient at the item size, with the gradient itself in m_tint.
+     * Both are rasterized once per size by the shared gradient and reused by every item using it.
+     */
+    const QImage &OpacityRenderer::opacityMask(const OpacityInputs &inputs) {
+        if (!m_mask.isNull() && m_mask.size() == inputs.size && m_maskGradient == inputs.gradient) return m_mask;
+
+        inputs.gradient->rasters(inputs.size, m_mask, m_tint);
+        m_maskGradient = inputs.gradient;
+        return m_mask;
+    }
+
+    /**
+     * @fn compositedImage
+     * @brief The prepared image through the gradient mask, tinted by the gradient, in a single pass
+     * (see compositeMaskedTint). Cached until the size, the gradient (through the mask) or the prepared image change,
+     * a new prepared image only recomputes the tiles where it differs.
+     */
+    const QImage &OpacityRenderer::compositedImage(const OpacityInputs &inputs, const QImage &image) {
+        const QSize &size = inputs.size;
+        const QImage &mask = opacityMask(inputs);
+        const QImage &front = m_composited.front();
+        const bool sameLayout = !front.isNull() && front.size() == size && m_compositedMaskKey == mask.cacheKey();
+        if (sameLayout && m_compositedImageKey == image.cacheKey()) return front;
 
-        if (getBorder() <= 0) {
-            painter->setPen(Qt::NoPen);
+        TileGrid dirty;
+        dirty.reset(size);
+        if (!sameLayout) {
+            dirty.markAll();
         } else {
-            pen.setWidth(getBorder());
-            painter->setPen(pen);
-            painter->drawPath(borderPath);
-        }
-
-        if (m_gradient) {
-            QImage opacityMask(QSize(dSize.toSize()), QImage::Format_Alpha8);
-            QPainter oPainter(&opacityMask);
-            QImage resultImage(dSize.toSize(), QImage::Format_ARGB32_Premultiplied);
-            QPainter iPainter(&resultImage);
-
-            oPainter.setCompositionMode(QPainter::CompositionMode_Source);
-            if (m_gradient->type() == QGradient::LinearGradient) {
-                oPainter.fillRect(opacityMask.rect(), m_linearGradient);
-            } else if (m_gradient->type() == QGradient::RadialGradient) {
-                oPainter.fillRect(opacityMask.rect(), m_radialGradient);
-            } else if (m_gradient->type() == QGradient::ConicalGradient) {
-                oPainter.fillRect(opacityMask.rect(), m_conicalGradient);
-            } else {
-            }
-            oPainter.end();
+            inheritChanges(dirty, m_preparedChanges, m_compositedImageKey, image);
+        }
+
+        const qint64 fromKey = front.cacheKey();
+        QImage &back = m_composited.back(size, QImage::Format_ARGB32_Premultiplied, dirty);
+        if (back.isNull()) return image;
+        for (int i = 0; i < dirty.count(); i++) {
+            if (!dirty.isDirty(i)) continue;
+            const QRect rect = dirty.tileRect(i);
+            if (compositeMaskedTint(back, image, mask, m_tint, rect)) continue;
 
+            /* Formats the kernel does not handle */
+            QPainter iPainter(&back);
+            iPainter.setClipRect(rect);
             iPainter.setCompositionMode(QPainter::CompositionMode_Source);
-            iPainter.fillRect(resultImage.rect(), Qt::transparent);
+            iPainter.fillRect(rect, Qt::transparent);
             iPainter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-            iPainter.drawImage(0, 0, opacityMask);
+            iPainter.drawImage(0, 0, mask);
             iPainter.setCompositionMode(QPainter::CompositionMode_SourceAtop);
-            iPainter.drawImage(0, 0, m_image);
+            iPainter.drawImage(0, 0, image);
+            iPainter.drawImage(0, 0, m_tint);
             iPainter.end();
+        }
+
+        m_composited.swap(dirty);
+        m_compositedChanges.fromKey = fromKey;
+        m_compositedChanges.toKey = m_composited.front().cacheKey();
+        m_compositedChanges.tiles = dirty;
+        m_compositedMaskKey = mask.cacheKey();
+        m_compositedImageKey = image.cacheKey();
+        return m_composited.front();
+    }
+
+    /**
+     * @fn shapedImage
+     * @brief The image clipped to the rounded rect of the item, the border shows where the image does not cover it.
+     * The antialiased coverage comes from ShapeMaskCache and is applied with multiplyCoverage instead of a clip path.
+     * Cached until the image, the shape or the border color change, and then only the tiles they touch are recomputed:
+     * the corners for a new radius, the visible border for a new border color.
+     */
+    const QImage &OpacityRenderer::shapedImage(const OpacityInputs &inputs, const QImage &image, const TileChanges &imageChanges) {
+        const QSize &size = inputs.size;
+        /* Nothing to clip out of the item bounds */
+        if (inputs.radius <= 0 && inputs.border <= 0) return image;
 
-            painter->drawImage(0, 0, resultImage);
+        ShapeMask shape = ShapeMaskCache::instance()->mask(size, inputs.radius, inputs.border);
+        if (shape.coverage.isNull()) return image;
+
+        const QRgb borderColor = inputs.borderColor;
+        const QImage &front = m_shaped.front();
+        const bool sameLayout = !front.isNull() && front.size() == size;
+        if (sameLayout && m_shapedImageKey == image.cacheKey() && m_shapedCoverage.cacheKey() == shape.coverage.cacheKey() &&
+            m_shapedBorder.cacheKey() == shape.border.cacheKey() && m_shapedBorderColor == borderColor) {
+            return front;
+        }
+
+        QImage source = image;
+        if (source.format() != QImage::Format_ARGB32_Premultiplied && source.format() != QImage::Format_RGB32) {
+            source = source.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        }
+        const int imageWidth = qMin(source.width(), size.width());
+        const int imageHeight = qMin(source.height(), size.height());
+
+        TileGrid dirty;
+        dirty.reset(size);
+        if (!sameLayout) {
+            dirty.markAll();
         } else {
-            painter->drawImage(0, 0, m_image);
+            if (m_shapedImageKey != image.cacheKey()) inheritChanges(dirty, imageChanges, m_shapedImageKey, image);
+            dirty.markChanged(m_shapedCoverage, shape.coverage);
+            if (m_shapedBorder.isNull() != shape.border.isNull()) {
+                dirty.markAll();
+            } else if (!shape.border.isNull()) {
+                dirty.markChanged(m_shapedBorder, shape.border);
+                /* The border only shows where the image does not cover the item */
+                if (m_shapedBorderColor != borderColor) dirty.markNonZero(shape.border, QRect(0, 0, imageWidth, imageHeight));
+            }
+        }
+
+        const qint64 fromKey = front.cacheKey();
+        QImage &back = m_shaped.back(size, QImage::Format_ARGB32_Premultiplied, dirty);
+        if (back.isNull()) return image;
+
+        /* Border color at each coverage of the stroke */
+        quint32 borderRamp[256] = {0};
+        if (!shape.border.isNull()) {
+            for (int i = 0; i < 256; i++) {
+                borderRamp[i] = qPremultiply(qRgba(qRed(borderColor), qGreen(borderColor), qBlue(borderColor), (qAlpha(borderColor) * i + 127) / 255));
+            }
         }
 
-        if (m_gradient) {
-            painter->setCompositionMode(QPainter::CompositionMode_SourceAtop);
-            if (m_gradient->type() == QGradient::LinearGradient) {
-                painter->fillRect(boundingRect(), m_linearGradient);
-            } else if (m_gradient->type() == QGradient::RadialGradient) {
-                painter->fillRect(boundingRect(), m_radialGradient);
-            } else if (m_gradient->type() == QGradient::ConicalGradient) {
-                painter->fillRect(boundingRect(), m_conicalGradient);
+        for (int i = 0; i < dirty.count(); i++) {
+            if (!dirty.isDirty(i)) continue;
+            const QRect rect = dirty.tileRect(i);
+            for (int y = rect.top(); y <= rect.bottom(); y++) {
+                quint32 *line = reinterpret_cast<quint32 *>(back.scanLine(y));
+                int x = rect.left();
+                if (y < imageHeight && x < imageWidth) {
+                    const int copied = qMin(imageWidth, rect.right() + 1) - x;
+                    memcpy(line + x, reinterpret_cast<const quint32 *>(source.constScanLine(y)) + x, copied * sizeof(quint32));
+                    x += copied;
+                }
+                const uchar *stroke = shape.border.isNull() ? NULL : shape.border.constScanLine(y);
+                for (; x <= rect.right(); x++) line[x] = stroke ? borderRamp[stroke[x]] : 0;
             }
+            multiplyCoverage(back, shape.coverage, rect);
         }
-        painter->restore();
+
+        m_shaped.swap(dirty);
+        m_shapedChanges.fromKey = fromKey;
+        m_shapedChanges.toKey = m_shaped.front().cacheKey();
+        m_shapedChanges.tiles = dirty;
+        m_shapedImageKey = image.cacheKey();
+        m_shapedCoverage = shape.coverage;
+        m_shapedBorder = shape.border;
+        m_shapedBorderColor = borderColor;
+        return m_shaped.front();
     }
 
-    void OpacityImage::setSource(const QString image) {
+    void OpacityImageBase::setSource(const QString image) {
         if (m_source == image) return;
         m_source = image;
         emit sourceChanged();
     }
 
-    void OpacityImage::setRadius(const qreal &newRadius) {
+    void OpacityImageBase::setRadius(const qreal &newRadius) {
         if (m_radius == newRadius) return;
         m_radius = newRadius;
-        update();
+        polish();
         emit radiusChanged();
     }
 
-    void OpacityImage::setResizeMode(ResizeMode newResizemode) {
+    void OpacityImageBase::setResizeMode(ResizeMode newResizemode) {
         if (m_resizemode == newResizemode) return;
         m_resizemode = newResizemode;
-        update();
+        polish();
         emit resizeModeChanged();
     }
 
-    void OpacityImage::setGradientJSValue(QJSValue &value) {
-        m_gradient = NULL;
-        if (!value.isObject() || value.isNull()) return;
+    void OpacityImageBase::setGradientJSValue(QJSValue &value) {
+        if (!value.isObject() || value.isNull()) {
+            m_gradient = NULL;
+            m_gradientJsValue = QJSValue();
+            polish();
+            return;
+        }
+        /* Same gradient object, keep the interned gradient */
         if (m_gradientJsValue.equals(value)) return;
 
         QJSValue prop;
@@ -389,101 +2154,203 @@ namespace qtwrapper
             m_gradientObject["stops"] = stopsList;
         }
         setGradient(m_gradientObject);
-        update();
+        polish();
         emit gradientJSValueChanged();
     }
 
-    void OpacityImage::setGradient(const QVariantMap &map) {
-
-        QVariantList stopsList = map["stops"].toList();
-        QGradient::Type type = static_cast<QGradient::Type>(map["type"].toInt());
-        switch (type) {
-        case QGradient::LinearGradient: {
-            QPointF startP(map["x1"].toDouble(), map["y1"].toDouble());
-            QPointF stopP(map["x2"].toDouble(), map["y2"].toDouble());
-            m_linearGradient.setStart(startP);
-            m_linearGradient.setFinalStop(stopP);
-            m_gradient = &m_linearGradient;
-        } break;
-        case QGradient::RadialGradient: {
-            QPointF cp(map["centerX"].toDouble(), map["centerY"].toDouble());
-            QPointF fp(map["focalX"].toDouble(), map["focalY"].toDouble());
-            qreal centerRadius = map["centerRadius"].toDouble();
-            qreal focalRadius = map["focalRadius"].toDouble();
-
-            if (focalRadius != 0)
-                m_radialGradient = QRadialGradient(cp, centerRadius, fp, focalRadius);
-            else
-                m_radialGradient = QRadialGradient(cp, centerRadius);
-
-            m_gradient = &m_radialGradient;
-        } break;
-        case QGradient::ConicalGradient: {
-            QPointF cP(map["centerX"].toDouble(), map["centerY"].toDouble());
-            m_conicalGradient.setCenter(cP);
-            m_conicalGradient.setAngle(map["angle"].toDouble());
-            m_gradient = &m_conicalGradient;
-        } break;
-        default:
-            break;
-        }
-
-        m_gradient->setCoordinateMode(QGradient::LogicalMode);
-        for (auto stopVariant : stopsList) {
-            QVariantMap stopMap = stopVariant.toMap();
-            double position = stopMap["position"].toDouble();
-            QColor color(stopMap["color"].toString());
-            if (m_gradient)
-                m_gradient->setColorAt(position, color);
-        }
+    /**
+     * @fn setGradient
+     * @brief Items with the same gradient share one parsed gradient, with its color table and rasters
+     */
+    void OpacityImageBase::setGradient(const QVariantMap &map) {
+        m_gradient = GradientRegistry::instance()->intern(map);
     }
 
-    qreal OpacityImage::getBorder() const { return m_border; }
+    qreal OpacityImageBase::getBorder() const { return m_border; }
 
-    void OpacityImage::setBorder(qreal newBorder) {
+    void OpacityImageBase::setBorder(qreal newBorder) {
         if (qFuzzyCompare(m_border, newBorder))
             return;
         m_border = newBorder;
-        update();
+        polish();
         emit borderChanged();
     }
 
-    QString OpacityImage::getBorderColor() const { return m_borderColor; }
+    QString OpacityImageBase::getBorderColor() const { return m_borderColor; }
 
-    void OpacityImage::setBorderColor(const QString &newBorderColor) {
+    void OpacityImageBase::setBorderColor(const QString &newBorderColor) {
         if (m_borderColor == newBorderColor)
             return;
         m_borderColor = newBorderColor;
-        update();
+        polish();
         emit borderColorChanged();
     }
 
-    bool OpacityImage::getxMirror() const { return m_xMirror; }
+    bool OpacityImageBase::getxMirror() const { return m_xMirror; }
 
-    void OpacityImage::setxMirror(bool newXMirror) {
+    void OpacityImageBase::setxMirror(bool newXMirror) {
         if (m_xMirror == newXMirror)
             return;
         m_xMirror = newXMirror;
-        update();
+        polish();
         emit xMirrorChanged();
     }
 
-    bool OpacityImage::getyMirror() const { return m_yMirror; }
+    bool OpacityImageBase::getyMirror() const { return m_yMirror; }
 
-    void OpacityImage::setyMirror(bool newYMirror) {
+    void OpacityImageBase::setyMirror(bool newYMirror) {
         if (m_yMirror == newYMirror)
             return;
         m_yMirror = newYMirror;
-        update();
+        polish();
         emit yMirrorChanged();
     }
 
-    QString OpacityImage::getURL() const { return m_url; }
+    QString OpacityImageBase::getURL() const { return m_url; }
 
-    void OpacityImage::setURL(const QString &newUrl) {
+    void OpacityImageBase::setURL(const QString &newUrl) {
         if (m_url == newUrl)
             return;
         m_url = newUrl;
         emit urlChanged();
     }
+
+    bool OpacityImageBase::getAsynchronous() const { return m_asynchronous; }
+
+    void OpacityImageBase::setAsynchronous(bool newAsynchronous) {
+        if (m_asynchronous == newAsynchronous)
+            return;
+        m_asynchronous = newAsynchronous;
+        polish();
+        emit asynchronousChanged();
+    }
+
+    /**
+     * @fn OpacityTextureProvider
+     * @brief Texture provider of an OpacityImageNode, lives on the render thread and follows the texture of its node
+     */
+    class OpacityTextureProvider : public QSGTextureProvider
+    {
+    private:
+        QSGTexture *m_texture;
+
+    public:
+        OpacityTextureProvider() :
+            m_texture(NULL) {
+        }
+
+        QSGTexture *texture() const override { return m_texture; }
+
+        void setTexture(QSGTexture *texture) {
+            if (m_texture == texture) return;
+            m_texture = texture;
+            emit textureChanged();
+        }
+    };
+
+    /**
+     * @fn TextureProviderCleanup
+     * @brief Delete a texture provider on the render thread
+     */
+    class TextureProviderCleanup : public QRunnable
+    {
+    private:
+        OpacityTextureProvider *m_provider;
+
+    public:
+        explicit TextureProviderCleanup(OpacityTextureProvider *provider) :
+            m_provider(provider) {
+        }
+
+        void run() override { delete m_provider; }
+    };
+
+    OpacityImageNode::OpacityImageNode() :
+        OpacityImageBase(),
+        m_textureKey(0),
+        m_texture(NULL),
+        m_provider(NULL) {
+        setFlag(ItemHasContents);
+    }
+
+    OpacityImageNode::~OpacityImageNode() {
+        releaseResources();
+    }
+
+    void OpacityImageNode::updatePolish() {
+        update();
+    }
+
+    void OpacityImageNode::updateContent(const QRect &dirty) {
+        Q_UNUSED(dirty);
+        update();
+    }
+
+    /**
+     * @fn textureProvider
+     * @brief Called on the render thread, the provider is created on first use and shares the texture of the node
+     */
+    QSGTextureProvider *OpacityImageNode::textureProvider() const {
+        if (!m_provider) {
+            m_provider = new OpacityTextureProvider();
+            m_provider->setTexture(m_texture);
+        }
+        return m_provider;
+    }
+
+    /**
+     * @fn releaseResources
+     * @brief The item leaves its window or is destroyed, the scene graph deletes the node and its texture,
+     * the provider is deleted on the render thread
+     */
+    void OpacityImageNode::releaseResources() {
+        m_textureKey = 0;
+        m_texture = NULL;
+        if (!m_provider) return;
+        if (window()) {
+            window()->scheduleRenderJob(new TextureProviderCleanup(m_provider), QQuickWindow::AfterSynchronizingStage);
+        } else {
+            delete m_provider;
+        }
+        m_provider = NULL;
+    }
+
+    /**
+     * @fn updatePaintNode
+     * @brief Called on the render thread while the GUI thread is blocked. The image is composed in device pixels
+     * and the node is kept for the life of the item: a new composited image only replaces its texture, which the
+     * node owns and deletes when it is replaced.
+     */
+    QSGNode *OpacityImageNode::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data) {
+        Q_UNUSED(data);
+        QSGImageNode *node = static_cast<QSGImageNode *>(oldNode);
+        QQuickWindow *win = window();
+        const qreal dpr = win ? win->effectiveDevicePixelRatio() : 1;
+        QImage image = win ? renderedImage(QSize(qCeil(width() * dpr), qCeil(height() * dpr)), dpr) : QImage();
+        if (image.isNull()) {
+            delete node;
+            m_textureKey = 0;
+            m_texture = NULL;
+            if (m_provider) m_provider->setTexture(NULL);
+            return NULL;
+        }
+
+        if (!node) {
+            node = win->createImageNode();
+            node->setOwnsTexture(true);
+            m_textureKey = 0;
+        }
+        if (m_textureKey != image.cacheKey()) {
+            m_texture = win->createTextureFromImage(image);
+            node->setTexture(m_texture);
+            m_textureKey = image.cacheKey();
+            if (m_provider) m_provider->setTexture(m_texture);
+        }
+
+        /* An image larger than the item (Scaled, Fixed) is cut to the item bounds like a painted item does */
+        const QRectF source(0, 0, qMin<qreal>(image.width(), width() * dpr), qMin<qreal>(image.height(), height() * dpr));
+        node->setSourceRect(source);
+        node->setRect(QRectF(0, 0, source.width() / dpr, source.height() / dpr));
+        return node;
+    }
 } // namespace qtwrapper
\ No newline at end of file
@@ -13,13 +13,166 @@
 #define __IMAGEPROVIDER_H__
 
 #include <QQuickImageProvider>
-#include <QQuickPaintedItem>
+#include <QQuickItem>
 #include <QGradient>
 #include <QImage>
+#include <QMutex>
+#include <QList>
+#include <QStringList>
+#include <QPointer>
+#include <QSet>
+#include <QPair>
+#include <QVariantMap>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include "framestream.h"
+#include "gradientregistry.h"
+#include "tilegrid.h"
+
+class QSGTexture;
 
 namespace qtwrapper
 {
+    class QWorkerPool;
+    class QWorkerTask;
+    class AsyncImageProvider;
+    class ImageDiskCache;
+    class OpacityRenderer;
+
+    /**
+     * @brief Called to decode again an image evicted from ImageProvider which was not loaded from a file.
+     * Return true and fill "image" if the image could be reloaded.
+     */
+    using ImageReloadHandler = std::function<bool(const QString &id, QImage &image)>;
+
+    /**
+     * @brief Immutable, reference counted image handed out by ImageProvider.
+     * It stays valid when the image is updated or evicted, an update publishes a new snapshot.
+     */
+    using ImageSnapshot = std::shared_ptr<const QImage>;
+
+    /**
+     * @fn ImageSource
+     * @brief One image to ingest in a batch: encoded data, a file path or an already decoded image.
+     * The first one set is used, in the order image, data, path.
+     */
+    struct ImageSource {
+        QString id;
+        QImage image;
+        QByteArray data;
+        QString path;
+        QSize maxSize;
+    };
+
+    /**
+     * @fn ImagePrefetch
+     * @brief Progress of an ImageProvider::prefetch. Each image is available as soon as it is decoded.
+     * The handle is only valid while the provider is alive.
+     */
+    class ImagePrefetch
+    {
+        friend class ImageProvider;
+
+    private:
+        QList<std::shared_ptr<QWorkerTask>> m_tasks;
+        std::atomic<int> m_completed;
+        std::atomic<int> m_loaded;
+
+    public:
+        ImagePrefetch();
+
+        int total() const;
+        /* Images processed so far, loaded or failed */
+        int completed() const;
+        int loaded() const;
+        bool isDone() const;
+
+        /**
+         * @fn wait
+         * @brief Wait until every image is processed or canceled
+         *
+         * @param msecs     Timeout in milliseconds, -1 to wait forever
+         * @return bool     false on timeout
+         */
+        bool wait(int msecs = -1);
+
+        /**
+         * @fn cancel
+         * @brief Drop the images not started yet
+         */
+        void cancel();
+    };
+
+    using ImagePrefetchPtr = std::shared_ptr<ImagePrefetch>;
+
+    /**
+     * @brief Called from the decode threads each time a prefetched image is processed
+     */
+    using ImagePrefetchProgress = std::function<void(int completed, int total)>;
+
+    /**
+     * @fn ImageStream
+     * @brief Ingestion handle of an encoded image arriving in chunks (socket, file being written).
+     * While chunks arrive, what is already there is decoded at a reduced size on the decode pool and published
+     * under the id, a progressive JPEG refines at each preview. Each preview decodes the whole buffer again,
+     * so they are spaced as the data doubles and capped, which bounds their cost to about two full decodes.
+     * finish() decodes and publishes the full image, no preview is published after it.
+     * Chunks are appended to a single buffer, previews read it in place. Methods can be called from any thread.
+     */
+    class ImageStream : public std::enable_shared_from_this<ImageStream>
+    {
+        friend class ImageProvider;
+
+    private:
+        ImageProvider *m_provider;
+        QString m_id;
+        QSize m_maxSize;
+        QMutex m_mtx;
+        QByteArray m_data;
+        /* Chunks received while a preview reads m_data */
+        QByteArray m_pending;
+        int m_previewedBytes;
+        int m_previews;
+        bool m_previewing;
+        bool m_finished;
+        std::shared_ptr<QWorkerTask> m_previewTask;
+        /* Generation of the last image committed by the stream, guarded by the provider lock.
+         * Previews are numbered in the order they read the data and finish() commits the last generation,
+         * so a late preview never replaces a newer one or the final image. */
+        quint64 m_committed;
+
+        ImageStream(ImageProvider *provider, const QString &id, const QSize &maxSize, qint64 expectedSize);
+        void schedulePreviewLocked();
+        void decodePreview(quint64 generation);
+
+    public:
+        /**
+         * @fn append
+         * @brief Add the next chunk of the encoded image
+         *
+         * @return int  0 on success, -1 if the stream is finished
+         */
+        int append(const char *buf, size_t size);
+
+        /**
+         * @fn finish
+         * @brief Decode the complete image and publish it, the buffered data is released
+         *
+         * @return int  0 on success, -1 if the image could not be decoded or the stream is finished
+         */
+        int finish();
+
+        /**
+         * @fn abort
+         * @brief Drop the stream, the last preview published stays in the store
+         */
+        void abort();
+    };
+
+    using ImageStreamPtr = std::shared_ptr<ImageStream>;
+
     /**
      * @fn ImageProvider
      * @brief
@@ -28,7 +181,92 @@ namespace qtwrapper
     class ImageProvider : public QQuickImageProvider
     {
         Q_OBJECT
-        std::map<QString, QImage *> m_imagesMap;
+        friend class AsyncImageProvider;
+        friend class ImageStream;
+
+        /* Published content of an entry, never modified once published */
+        struct ImageState {
+            QImage image;
+            /* Downscaled copies of image served to requestImage, keyed by their size */
+            QList<QPair<QSize, QImage>> variants;
+        };
+        using ImageStatePtr = std::shared_ptr<const ImageState>;
+
+        struct ImageEntry {
+            /* Read with std::atomic_load without the provider lock, replaced with std::atomic_store under the write lock.
+             * Neither is lock free itself (libstdc++ guards shared_ptr atomics with a small pool of mutexes held for the
+             * pointer copy), readers only avoid waiting on the provider lock. */
+            ImageStatePtr state;
+            /* Source file to reload the image from after eviction (empty if not loaded from a file) */
+            QString path;
+            QSize maxSize;
+            /* Key of the shared pixels in m_contents (empty if the image is not shared) */
+            QByteArray contentKey;
+            std::atomic<bool> evicted;
+            /* Time of the last failed reload (QDateTime::currentMSecsSinceEpoch), 0 if none since the last commit */
+            std::atomic<qint64> reloadFailedAt;
+            std::atomic<quint64> lastUse;
+            std::atomic<int> pins;
+
+            ImageEntry() :
+                evicted(false), reloadFailedAt(0), lastUse(0), pins(0) {}
+        };
+
+        /* Entries are only deleted with the provider, so an entry pointer stays valid once looked up */
+        using ImageIndex = std::map<QString, ImageEntry *>;
+
+        /* Decoded pixels shared by every entry with the same content */
+        struct SharedContent {
+            QImage image;
+            int refs;
+        };
+
+        struct ImageSubscriber {
+            QPointer<QObject> receiver;
+            std::function<void()> handler;
+        };
+
+        /* Copy on write index read without the provider lock. New ids first go to m_recentEntries (under the lock)
+         * and are merged into a new copy once they are a fraction of it, adding N ids copies O(N) nodes in total */
+        std::shared_ptr<const ImageIndex> m_imagesMap;
+        ImageIndex m_recentEntries;
+        /* Frame streams by id, copy on write like m_imagesMap since it is looked up on every read */
+        using FrameStreamMap = std::map<QString, FrameStreamPtr>;
+        std::shared_ptr<const FrameStreamMap> m_streams;
+        QMutex m_subscribersMtx;
+        std::map<QString, QList<ImageSubscriber>> m_subscribers;
+        QSet<QString> m_dirtyIds;
+        bool m_flushScheduled;
+        QWorkerPool *m_decodePool;
+        qint64 m_memoryBudget;
+        qint64 m_residentBytes;
+        qint64 m_sharedBytes;
+        std::map<QByteArray, SharedContent> m_contents;
+        /* Published references to each pixel buffer, keyed by the serial part of QImage::cacheKey */
+        std::map<qint64, int> m_buffers;
+        std::atomic<bool> m_pixelDedup;
+        std::atomic<quint64> m_useClock;
+        ImageReloadHandler m_reloadHandler;
+        /* Decode pool task loading an id: a reload of fetchImage, updateImageAsync, prefetch or AsyncImageProvider job */
+        struct ImageLoadTask {
+            std::shared_ptr<QWorkerTask> task;
+            /* Priority it was submitted with, requesters can only raise it */
+            int priority;
+            /* Priority it is queued at */
+            int queued;
+            /* Reload started by fetchImage, canceled once nobody requests it anymore */
+            bool reload;
+            quint64 serial;
+        };
+        /* Pending loads of an id and the priorities its requesters (fetchImage) want them at */
+        struct ImageLoad {
+            QList<ImageLoadTask> tasks;
+            std::map<const void *, int> requesters;
+        };
+        QMutex m_loadsMtx;
+        std::map<QString, ImageLoad> m_loads;
+        quint64 m_loadSerial;
+        std::shared_ptr<ImageDiskCache> m_diskCache;
 
     private:
         static ImageProvider *m_instance;
@@ -40,11 +278,46 @@ namespace qtwrapper
         ImageProvider(const ImageProvider &&) = delete;
         ImageProvider &operator=(const ImageProvider &) = delete;
 
+        void commitImage(const QString &id, QImage &image, const QByteArray &key, const QString &path = QString(), const QSize &maxSize = QSize());
+        bool commitStreamImage(ImageStream *stream, quint64 generation, QImage &image, const QByteArray &key);
+        ImageEntry *commitLocked(const QString &id, QImage &image, const QByteArray &key, const QString &path, const QSize &maxSize, QList<ImageStatePtr> &released);
+        bool findContent(const QByteArray &key, QImage &out);
+        bool loadData(const QByteArray &data, const QSize &maxSize, QImage &out, QByteArray &key);
+        bool loadFile(const QString &file, const QSize &maxSize, QImage &out, QByteArray &key);
+        bool loadSource(const ImageSource &source, QImage &out, QByteArray &key);
+        QByteArray imageKey(const QImage &image) const;
+        void shareContentLocked(ImageEntry *entry, const QByteArray &key, QImage &image);
+        void releaseContentLocked(ImageEntry *entry);
+        void countBufferLocked(const QImage &image, int refs);
+        void countStateLocked(const ImageState &state, int refs);
+        std::shared_ptr<QWorkerTask> scheduleLoad(const QString &id, int priority, std::function<void()> fnc);
+        std::shared_ptr<QWorkerTask> scheduleLoadLocked(const QString &id, int priority, bool reload, std::function<void()> fnc);
+        void prioritizeLocked(ImageLoad &load);
+        void dropCanceledLocked(ImageLoad &load);
+        void finishLoad(const QString &id, quint64 serial);
+        ImageEntry *findEntry(const QString &id);
+        ImageEntry *findEntryLocked(const QString &id);
+        ImageEntry *entryLocked(const QString &id);
+        void publishLocked(ImageEntry *entry, const ImageStatePtr &state, QList<ImageStatePtr> &released);
+        ImageStatePtr loadState(const QString &id);
+        ImageStatePtr reloadImage(const QString &id, ImageEntry *entry);
+        void touchEntry(ImageEntry *entry);
+        void evictLocked(const ImageEntry *keep, QList<ImageStatePtr> &released);
+        void notifyChanged(const QStringList &ids);
+        void flushNotifications();
+
     public:
         static ImageProvider *instance();
         void destroy();
-        QImage *image(const QString &id);
-        QImage *image(const char *id);
+        /**
+         * @fn image
+         * @brief Get a snapshot of the image without taking any provider lock
+         *
+         * @param id    Image id (this value is mapping with "source" in qml)
+         * @return ImageSnapshot    NULL if the image does not exist
+         */
+        ImageSnapshot image(const QString &id);
+        ImageSnapshot image(const char *id);
 
         /**
          * @fn getImage
@@ -59,45 +332,337 @@ namespace qtwrapper
          * @fn updateImage
          * @brief Add if not exists or update the current image in provider resource
          *
-         * @param id    Image id (this value is mapping with "source" in qml)
-         * @param buf   Image binary data
-         * @param size  Image size
+         * @param id        Image id (this value is mapping with "source" in qml)
+         * @param buf       Image binary data
+         * @param size      Image size
+         * @param maxSize   If set, the image is decoded to fit in maxSize (JPEG is downscaled by the decoder)
+         */
+        void updateImage(const char *id, const char *buf, size_t size, const QSize &maxSize = QSize());
+
+        /**
+         * @fn updateImage
+         * @brief The file is memory mapped when possible and decoded straight from the mapping
+         *
+         * @param id        Image id (this value is mapping with "source" in qml)
+         * @param path      Image file path (note: "qrc:/" prefix is replaced with ":/")
+         * @param maxSize   If set, the image is decoded to fit in maxSize (JPEG is downscaled by the decoder)
          */
-        void updateImage(const char *id, const char *buf, size_t size);
+        void updateImage(const char *id, const QString &path, const QSize &maxSize = QSize());
 
         /**
          * @fn updateImage
          * @brief
          *
          * @param id    Image id (this value is mapping with "source" in qml)
-         * @param path  Image file path (note: "qrc:/" prefix is replaced with ":/")
+         * @param img   Image object to copy from (shallow copy, the pixels are shared with img)
          */
-        void updateImage(const char *id, const QString &path);
+        void updateImage(const char *id, const QImage &img);
 
         /**
          * @fn updateImage
          * @brief
          *
          * @param id    Image id (this value is mapping with "source" in qml)
-         * @param img   Image object to copy from
+         * @param img   Image object to move from
          */
-        void updateImage(const char *id, const QImage &img);
+        void updateImage(const char *id, QImage &&img);
 
+        /**
+         * @fn updateImage
+         * @brief Wrap already decoded pixels owned by the caller, nothing is decoded or copied.
+         * The buffer must stay valid and unchanged until cleanupFunction is called.
+         *
+         * @param id                Image id (this value is mapping with "source" in qml)
+         * @param data              Pixel buffer
+         * @param width             Image width
+         * @param height            Image height
+         * @param bytesPerLine      Stride of the buffer
+         * @param format            Pixel format of the buffer
+         * @param cleanupFunction   Called with cleanupInfo once the provider no longer uses the buffer
+         * @param cleanupInfo       User data passed to cleanupFunction
+         */
+        void updateImage(const char *id, uchar *data, int width, int height, int bytesPerLine, QImage::Format format,
+                         QImageCleanupFunction cleanupFunction = NULL, void *cleanupInfo = NULL);
+
+        /**
+         * @fn updateImage
+         * @brief Wrap raw pixels stored in a file (camera dumps, pre-converted assets), nothing is decoded or copied.
+         * The image is backed by a read-only mapping of the file which is kept until the provider drops the image,
+         * pages are read by the system when they are first drawn.
+         *
+         * @param id                Image id (this value is mapping with "source" in qml)
+         * @param path              Pixel file path (note: "qrc:/" prefix is replaced with ":/", resources cannot be mapped)
+         * @param width             Image width
+         * @param height            Image height
+         * @param bytesPerLine      Stride of the pixels in the file
+         * @param format            Pixel format of the file
+         * @param offset            Offset of the first pixel in the file (size of a header)
+         * @return true             The file holds enough pixels and was mapped
+         */
+        bool updateImage(const char *id, const QString &path, int width, int height, int bytesPerLine, QImage::Format format,
+                         qint64 offset = 0);
+
+        /**
+         * @fn updateImageAsync
+         * @brief Same as updateImage but the data is copied and decoded on the decode pool.
+         * The call returns immediately, imageChanged is emitted once the image is committed.
+         *
+         * @param id        Image id (this value is mapping with "source" in qml)
+         * @param buf       Image binary data
+         * @param size      Image size
+         * @param maxSize   If set, the image is decoded to fit in maxSize
+         * @param priority  Higher value is decoded first, items showing the id raise it while it is queued
+         */
+        void updateImageAsync(const char *id, const char *buf, size_t size, const QSize &maxSize = QSize(), int priority = 0);
+
+        /**
+         * @fn updateImageAsync
+         * @brief Same as updateImage but the file is loaded on the decode pool.
+         *
+         * @param id        Image id (this value is mapping with "source" in qml)
+         * @param path      Image file path (note: "qrc:/" prefix is replaced with ":/")
+         * @param maxSize   If set, the image is decoded to fit in maxSize
+         * @param priority  Higher value is decoded first, items showing the id raise it while it is queued
+         */
+        void updateImageAsync(const char *id, const QString &path, const QSize &maxSize = QSize(), int priority = 0);
+
+        /**
+         * @fn updateImages
+         * @brief Decode a batch of images in parallel on the decode pool (and the calling thread),
+         * then commit them under a single lock and emit one imagesChanged for the whole batch.
+         * Items which fail to decode are skipped.
+         *
+         * @param items     Images to add or update
+         * @return int      Number of images committed
+         */
+        int updateImages(const QList<ImageSource> &items);
+
+        /**
+         * @fn prefetch
+         * @brief Decode images into the store on all the decode threads, without blocking the caller.
+         * Prefetch the visible images with a higher priority than the rest and wait on their handle only.
+         *
+         * @param items     Images to load (see ImageSource)
+         * @param priority  Higher value is decoded first
+         * @param progress  Optional, called from the decode threads
+         * @return ImagePrefetchPtr     Handle to follow, wait for or cancel the prefetch
+         */
+        ImagePrefetchPtr prefetch(const QList<ImageSource> &items, int priority = 0, ImagePrefetchProgress progress = NULL);
+
+        /**
+         * @fn openFrameStream
+         * @brief Serve id from a high rate frame feed (see FrameStream) instead of the image store.
+         * Reads of the id return the latest frame without copying it, subscribers are notified at most once
+         * per event loop iteration whatever the frame rate. requestImage returns stream frames at full size.
+         *
+         * @param id            Image id (this value is mapping with "source" in qml)
+         * @param frameCount    Pixel buffers recycled by the stream
+         * @return FrameStreamPtr   The stream already open for id if any
+         */
+        FrameStreamPtr openFrameStream(const QString &id, int frameCount = 3);
+        FrameStreamPtr frameStream(const QString &id);
+        void closeFrameStream(const QString &id);
+
+        /**
+         * @fn openStream
+         * @brief Start the ingestion of an encoded image arriving in chunks (see ImageStream)
+         *
+         * @param id            Image id (this value is mapping with "source" in qml)
+         * @param maxSize       If set, the image is decoded to fit in maxSize
+         * @param expectedSize  If known, total size of the encoded image to allocate the buffer once
+         * @return ImageStreamPtr
+         */
+        ImageStreamPtr openStream(const QString &id, const QSize &maxSize = QSize(), qint64 expectedSize = 0);
+
+        /**
+         * @fn fetchImage
+         * @brief Non blocking variant of image(): an evicted image is reloaded on the decode pool and the subscribers
+         * of the id are notified once it is back. The requests of several requesters share one load which runs with
+         * the highest of their priorities, calling fetchImage again with another priority reprioritizes it while it
+         * is queued. A negative priority withdraws the request, the load is canceled once nobody wants it anymore.
+         * Loads of the id already queued by updateImageAsync, prefetch or AsyncImageProvider are raised the same way.
+         * After a failed reload the image is reported unavailable for a while instead of being reloaded again.
+         *
+         * @param id        Image id (this value is mapping with "source" in qml)
+         * @param requester Identifies the request (usually the item showing the image)
+         * @param priority  Higher value is decoded first, negative to withdraw the request
+         * @param snapshot  Set to the image if it is available
+         * @return int      1 if snapshot is set, 0 if a load is pending, -1 if the image is not available
+         */
+        int fetchImage(const QString &id, const void *requester, int priority, ImageSnapshot &snapshot);
+
+        /**
+         * @fn cancelFetch
+         * @brief Withdraw a request made by fetchImage
+         */
+        void cancelFetch(const QString &id, const void *requester);
+
+        /**
+         * @fn requestImage
+         * @brief Return the image scaled down to fit requestedSize (keeping the aspect ratio).
+         * Scaled variants are cached per size until the image is updated, size is set to the original size.
+         *
+         * @param id            Image id (this value is mapping with "source" in qml)
+         * @param size          Original image size
+         * @param requestedSize "sourceSize" of the qml Image, an empty size returns the full image
+         * @return QImage
+         */
         QImage requestImage(const QString &id, QSize *size, const QSize &requestedSize) override;
 
+        /**
+         * @fn subscribe
+         * @brief Call handler when image "id" changes, only subscribers of that id are woken up.
+         * Handlers run in the provider thread (the GUI thread), updates of one id made before the
+         * next event loop iteration are coalesced into one call.
+         *
+         * @param id        Image id (this value is mapping with "source" in qml)
+         * @param receiver  Owner of the subscription, it is skipped once destroyed
+         * @param handler   Called on change
+         */
+        void subscribe(const QString &id, QObject *receiver, std::function<void()> handler);
+        void unsubscribe(const QString &id, QObject *receiver);
+
+        /**
+         * @fn setMemoryBudget
+         * @brief Limit the bytes of decoded pixels (images and scaled variants) held by the provider.
+         * When the budget is exceeded, the least recently used images which are not pinned are evicted,
+         * they are decoded again from their file, or through the reload handler, on the next request.
+         * Without a reload handler, images which were not loaded from a file are never evicted.
+         *
+         * @param bytes     Budget in bytes, 0 for no limit (default)
+         */
+        void setMemoryBudget(qint64 bytes);
+        qint64 memoryBudget();
+
+        /**
+         * @fn residentBytes
+         * @brief Bytes of decoded pixels currently held (QImage::sizeInBytes of images and scaled variants),
+         * a pixel buffer used by several ids, deduplicated or committed as shallow copies, is counted once
+         */
+        qint64 residentBytes();
+
+        /**
+         * @fn sharedBytes
+         * @brief Bytes saved by sharing the pixels of identical images between ids.
+         * Encoded sources are matched by content hash and decode size, QImage sources by their pixels
+         * when setPixelDeduplication is enabled, shallow copies of one QImage always share their buffer.
+         */
+        qint64 sharedBytes();
+
+        /**
+         * @fn setPixelDeduplication
+         * @brief Also share identical pixels committed as QImage or raw buffers (updateImage, ImageSource::image,
+         * reload handler). Each of those commits then hashes every pixel, and compares the images on a hash hit.
+         * Off by default, encoded data and files are always deduplicated by the hash of their encoded bytes.
+         */
+        void setPixelDeduplication(bool enabled);
+
+        /**
+         * @fn metrics
+         * @brief Counters of the provider (see ImageMetrics) with the store state: resident and shared bytes,
+         * budget, number of entries, largest entries, buffer pool stats, interned gradients and shape masks. Set the provider as a context
+         * property to read it from QML.
+         */
+        Q_INVOKABLE QVariantMap metrics();
+        Q_INVOKABLE void resetMetrics();
+
+        /**
+         * @fn setDiskCache
+         * @brief Keep decoded images of encoded sources (data and files) in a persistent cache.
+         * On the next start they are memory mapped from the cache instead of being decoded,
+         * a changed source has another content hash and is decoded (and cached) again.
+         * Stale entries are pruned on the decode pool when the cache is set, and while it grows.
+         *
+         * @param directory     Cache directory, empty to disable the cache (default)
+         * @param maxBytes      Size limit of the cache directory, 0 for no limit
+         * @param maxAgeDays    Entries not used for this many days are removed, 0 to keep them
+         */
+        void setDiskCache(const QString &directory, qint64 maxBytes = 0, int maxAgeDays = 0);
+
+        /**
+         * @fn setReloadHandler
+         * @brief Set the callback used to reload evicted images which were not loaded from a file
+         */
+        void setReloadHandler(ImageReloadHandler handler);
+
+        /**
+         * @fn pinImage
+         * @brief Keep an image resident while it is displayed, pins are counted
+         *
+         * @param id    Image id (this value is mapping with "source" in qml)
+         */
+        void pinImage(const QString &id);
+        void unpinImage(const QString &id);
+
     signals:
         void imageChanged(const QString id);
+        void imagesChanged(const QStringList ids);
     };
 
     /**
-     * @fn OpacityImage
-     * @brief A simple opacity mask image using QQuickPaintedItem to handle the painting job.
-     * Users can register OpacityImage to the QML engine and use it in a QML file.
+     * @fn ImageResponse
+     * @brief Response returned by AsyncImageProvider, completed from the ImageProvider decode pool.
+     */
+    class ImageResponse : public QQuickImageResponse
+    {
+        Q_OBJECT
+        friend class AsyncImageProvider;
+
+    private:
+        /* Cleared once the response is completed, a finished response never calls back into the provider */
+        std::atomic<AsyncImageProvider *> m_provider;
+        QString m_key;
+        QImage m_image;
+        QString m_errorString;
+
+        void complete(const QImage &image, const QString &error);
+
+    public:
+        ImageResponse(AsyncImageProvider *provider, const QString &key);
+        QQuickTextureFactory *textureFactory() const override;
+        QString errorString() const override;
+        void cancel() override;
+    };
+
+    /**
+     * @fn AsyncImageProvider
+     * @brief Asynchronous front-end of ImageProvider, serving the same images as QQuickImageResponse.
+     * Requests run on the ImageProvider decode pool, concurrent requests for the same id and size share one job,
+     * and a job is dropped from the queue once every response waiting for it has been canceled.
+     * Register it with engine.addImageProvider() instead of (or next to) ImageProvider::instance().
+     */
+    class AsyncImageProvider : public QQuickAsyncImageProvider
+    {
+        friend class ImageResponse;
+
+        struct RequestJob {
+            QList<ImageResponse *> responses;
+            std::shared_ptr<QWorkerTask> task;
+        };
+
+    private:
+        QMutex m_jobsMtx;
+        std::map<QString, RequestJob> m_jobs;
+
+        void runJob(const QString &key, const QString &id, const QSize &requestedSize);
+        bool cancelResponse(ImageResponse *response);
+
+    public:
+        AsyncImageProvider();
+        ~AsyncImageProvider();
+
+        QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+    };
+
+    /**
+     * @fn OpacityImageBase
+     * @brief Source, loading, properties and composition shared by OpacityImage and OpacityImageNode.
      * The image is provided by the ImageProvider or from a resource URL.
      * Users have to set the "source" (works with ImageProvider) or "url" in the QML file.
-     * Currently, OpacityImage supports LinearGradient (Gradient), RadialGradient, and ConicalGradient.
+     * Currently, it supports LinearGradient (Gradient), RadialGradient, and ConicalGradient.
+     * A radius of half the item size gives a circle.
      */
-    class OpacityImage : public QQuickPaintedItem
+    class OpacityImageBase : public QQuickItem
     {
         Q_OBJECT
         Q_PROPERTY(QString source READ getSource WRITE setSource NOTIFY sourceChanged)
@@ -109,6 +674,9 @@ namespace qtwrapper
         Q_PROPERTY(QJSValue gradient READ getGradientJSValue WRITE setGradientJSValue NOTIFY gradientJSValueChanged)
         Q_PROPERTY(bool xMirror READ getxMirror WRITE setxMirror NOTIFY xMirrorChanged)
         Q_PROPERTY(bool yMirror READ getyMirror WRITE setyMirror NOTIFY yMirrorChanged)
+        Q_PROPERTY(bool asynchronous READ getAsynchronous WRITE setAsynchronous NOTIFY asynchronousChanged)
+
+        friend class OpacityRenderer;
 
     public:
         enum class ResizeMode {
@@ -120,20 +688,23 @@ namespace qtwrapper
 
     private:
         QString m_source;
+        QString m_pinnedSource;
         QImage m_image;
+        /* Priority of the pending load of the source image, -1 if none */
+        int m_loadPriority;
+        QMetaObject::Connection m_frameConnection;
+        /* Composition of the item, with its caches and the state of asynchronous rendering */
+        std::shared_ptr<OpacityRenderer> m_renderer;
+        bool m_asynchronous;
         qreal m_radius;
         ResizeMode m_resizemode;
         QJSValue m_gradientJsValue;
         QVariantMap m_gradientObject;
-        QGradient *m_gradient;
-        QLinearGradient m_linearGradient;
-        QRadialGradient m_radialGradient;
-        QConicalGradient m_conicalGradient;
+        SharedGradientPtr m_gradient;
 
     public:
-        OpacityImage();
-        ~OpacityImage();
-        virtual void paint(QPainter *painter) override;
+        OpacityImageBase();
+        ~OpacityImageBase();
 
         QString getSource() const { return m_source; }
         void setSource(const QString image);
@@ -162,8 +733,41 @@ namespace qtwrapper
         QString getURL() const;
         void setURL(const QString &newUrl);
 
+        /**
+         * @fn setAsynchronous
+         * @brief Compose the item on a worker pool instead of the GUI thread. The item shows the last composed
+         * image until the one for the current properties is ready, nothing before the first one.
+         */
+        bool getAsynchronous() const;
+        void setAsynchronous(bool newAsynchronous);
+
+    protected:
+        void itemChange(ItemChange change, const ItemChangeData &value) override;
+
+        /**
+         * @fn renderedImage
+         * @brief The item content at this size: prepared image, gradient and shape composited, null if there is nothing to draw.
+         * Every step is cached, an unchanged item returns the same image (same cacheKey). An asynchronous item returns
+         * the last composed image and calls updateContent once the new one is ready.
+         *
+         * @param size      Size of the image in pixels
+         * @param scale     Pixels per item unit, the radius, the border and a Fixed image are scaled by it
+         * @param dirty     Set to the part of the item which changed, in item units (null for an asynchronous item)
+         */
+        QImage renderedImage(const QSize &size, qreal scale = 1, QRect *dirty = NULL);
+
+        const std::shared_ptr<OpacityRenderer> &renderer() const { return m_renderer; }
+
+        /**
+         * @fn updateContent
+         * @brief Show the new composed image, "dirty" is the part which changed in item units. Called on the GUI thread.
+         */
+        virtual void updateContent(const QRect &dirty) = 0;
+
     private:
         void setGradient(const QVariantMap &map);
+        int loadPriority();
+        void refreshImage();
         qreal m_border;
         QString m_borderColor;
         bool m_xMirror;
@@ -181,6 +785,171 @@ namespace qtwrapper
         void xMirrorChanged();
         void yMirrorChanged();
         void urlChanged();
+        void asynchronousChanged();
+    };
+
+    class OpacityImagePainter;
+
+    /**
+     * @fn OpacityImage
+     * @brief A simple opacity mask image painted by QPainter into a QQuickPaintedItem, which only repaints the tiles
+     * that changed. The painted item is an internal child filling the item, OpacityImage itself is a plain QQuickItem.
+     * Users can register OpacityImage to the QML engine and use it in a QML file.
+     */
+    class OpacityImage : public OpacityImageBase
+    {
+        Q_OBJECT
+
+    private:
+        OpacityImagePainter *m_painter;
+
+    public:
+        OpacityImage();
+
+    protected:
+        /**
+         * @fn updatePolish
+         * @brief Compose the item for its current properties before the frame is drawn, and repaint only what changed
+         */
+        void updatePolish() override;
+        void updateContent(const QRect &dirty) override;
+    };
+
+    class OpacityTextureProvider;
+
+    /**
+     * @fn OpacityImageNode
+     * @brief OpacityImage drawn by the scene graph: the composited image is uploaded once as a texture of a QSGImageNode
+     * and painted again only when it changes. Moving the item or changing its opacity does not repaint it on the CPU.
+     * Works with the software backend (QT_QUICK_BACKEND=software) which draws the image node directly.
+     * The image is composed at the device pixel ratio of the window, so it stays sharp on high DPI screens.
+     * Register it to QML like OpacityImage, it has the same properties. It is a texture provider for its texture,
+     * so a ShaderEffect or a ShaderEffectSource can use it without rendering it again.
+     */
+    class OpacityImageNode : public OpacityImageBase
+    {
+        Q_OBJECT
+
+    private:
+        /* Render thread only: cacheKey of the image in the texture of the node, and the texture */
+        qint64 m_textureKey;
+        QSGTexture *m_texture;
+        mutable OpacityTextureProvider *m_provider;
+
+    public:
+        OpacityImageNode();
+        ~OpacityImageNode();
+
+        bool isTextureProvider() const override { return true; }
+        QSGTextureProvider *textureProvider() const override;
+
+    protected:
+        /* The image is composed in updatePaintNode, at the device pixel ratio */
+        void updatePolish() override;
+        void updateContent(const QRect &dirty) override;
+        QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data) override;
+        void releaseResources() override;
+    };
+
+    /**
+     * @fn OpacityInputs
+     * @brief Everything the composited image of an OpacityImage depends on
+     */
+    typedef struct {
+        QImage image;
+        QSize size;
+        OpacityImageBase::ResizeMode resizeMode;
+        bool xMirror;
+        bool yMirror;
+        SharedGradientPtr gradient;
+        qreal radius;
+        qreal border;
+        QRgb borderColor;
+        /* Pixels per item unit, size, radius and border are already scaled */
+        qreal scale;
+    } OpacityInputs;
+
+    /**
+     * @fn OpacityRenderer
+     * @brief Composition of an OpacityImage: the source prepared for the item, through the gradient, clipped to its shape.
+     * Each step is cached for the inputs it was computed with. The gradient and shape steps are double buffered by tiles
+     * (see TiledBuffer), a change only copies and recomputes the tiles it touches. It runs either on the calling thread
+     * or on the composition pool, the item shows the front image (the last completed one) and repaints the tiles which
+     * changed since the previous front.
+     */
+    class OpacityRenderer : public std::enable_shared_from_this<OpacityRenderer>
+    {
+    private:
+        /* Held while composing, the caches below belong to one composition at a time */
+        QMutex m_composeMtx;
+        QImage m_prepared;
+        qint64 m_preparedKey;
+        QSize m_preparedSize;
+        OpacityImageBase::ResizeMode m_preparedMode;
+        qreal m_preparedScale;
+        bool m_preparedXMirror;
+        bool m_preparedYMirror;
+        TileChanges m_preparedChanges;
+        QImage m_mask;
+        QImage m_tint;
+        SharedGradientPtr m_maskGradient;
+        TiledBuffer m_composited;
+        qint64 m_compositedMaskKey;
+        qint64 m_compositedImageKey;
+        TileChanges m_compositedChanges;
+        TiledBuffer m_shaped;
+        qint64 m_shapedImageKey;
+        QImage m_shapedCoverage;
+        QImage m_shapedBorder;
+        QRgb m_shapedBorderColor;
+        TileChanges m_shapedChanges;
+
+        /* Shown image and asynchronous state */
+        QMutex m_mtx;
+        OpacityImageBase *m_item;
+        QImage m_front;
+        OpacityInputs m_requested;
+        bool m_hasRequested;
+        OpacityInputs m_pending;
+        bool m_hasPending;
+        bool m_running;
+
+        QImage composeLocked(const OpacityInputs &inputs, TileChanges &changes);
+        QRect publishLocked(const QImage &image, const TileChanges &changes, qreal scale);
+        const QImage &preparedImage(const OpacityInputs &inputs);
+        const QImage &opacityMask(const OpacityInputs &inputs);
+        const QImage &compositedImage(const OpacityInputs &inputs, const QImage &image);
+        const QImage &shapedImage(const OpacityInputs &inputs, const QImage &image, const TileChanges &imageChanges);
+        void run(const OpacityInputs &first);
+
+    public:
+        explicit OpacityRenderer(OpacityImageBase *item);
+
+        /**
+         * @fn detach
+         * @brief The item is destroyed, a running composition no longer asks it to update
+         */
+        void detach();
+
+        /**
+         * @fn render
+         * @brief Compose on the calling thread and show the result
+         *
+         * @return QRect    Part of the item to repaint, in item units, null if the image did not change
+         */
+        QRect render(const OpacityInputs &inputs);
+
+        /**
+         * @fn renderAsync
+         * @brief Compose on the composition pool, the item is asked to repaint the part which changed when it is shown
+         */
+        void renderAsync(const OpacityInputs &inputs, int priority);
+
+        /**
+         * @fn front
+         * @brief The last composed image, null before the first one or without source image
+         */
+        QImage front();
     };
 };     // namespace qtwrapper
 #endif // __IMAGEPROVIDER_H__
@@ -0,0 +1,119 @@
+/**
+ * @file shapemask.cpp
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "shapemask.h"
+#include <QPainter>
+#include <QPainterPath>
+
+namespace qtwrapper
+{
+    /* Bytes of the cached masks, each entry is 1 or 2 bytes per pixel: 8 MB holds about 16 full HD shapes
+     * or thousands of avatars. The most recently used mask is kept even if it is larger. */
+    static const qint64 sMaxShapeMaskBytes = 8 * 1024 * 1024;
+
+    /**
+     * @fn rasterizeShape
+     * @brief Same path and pen OpacityImage used to clip and stroke at each paint
+     */
+    static ShapeMask rasterizeShape(const QSize &size, qreal radius, qreal border) {
+        ShapeMask shape;
+        QPainterPath path;
+        path.addRoundedRect(QRectF(QPointF(0, 0), QSizeF(size)), radius, radius);
+
+        shape.coverage = QImage(size, QImage::Format_Alpha8);
+        if (shape.coverage.isNull()) return shape;
+        shape.coverage.fill(0);
+        QPainter cPainter(&shape.coverage);
+        cPainter.setRenderHint(QPainter::Antialiasing, true);
+        cPainter.fillPath(path, Qt::black);
+        cPainter.end();
+
+        if (border > 0) {
+            QPen pen(Qt::black);
+            pen.setWidthF(border);
+            shape.border = QImage(size, QImage::Format_Alpha8);
+            shape.border.fill(0);
+            QPainter bPainter(&shape.border);
+            bPainter.setRenderHint(QPainter::Antialiasing, true);
+            bPainter.strokePath(path, pen);
+            bPainter.end();
+        }
+        return shape;
+    }
+
+    static qint64 shapeMaskBytes(const ShapeMask &mask) {
+        return mask.coverage.sizeInBytes() + mask.border.sizeInBytes();
+    }
+
+    ShapeMaskCache::ShapeMaskCache() :
+        m_bytes(0),
+        m_hits(0),
+        m_misses(0) {
+    }
+
+    ShapeMaskCache *ShapeMaskCache::instance() {
+        static ShapeMaskCache cache;
+        return &cache;
+    }
+
+    ShapeMask ShapeMaskCache::mask(const QSize &size, qreal radius, qreal border) {
+        {
+            QMutexLocker locker(&m_mtx);
+            for (int i = 0; i < m_entries.size(); i++) {
+                const ShapeMaskEntry &entry = m_entries[i];
+                if (entry.size != size || entry.radius != radius || entry.border != border) continue;
+                if (i > 0) m_entries.move(i, 0);
+                m_hits++;
+                return m_entries.first().mask;
+            }
+            m_misses++;
+        }
+
+        /* Rasterize out of the lock, two items racing on a new shape both draw it and keep one */
+        ShapeMaskEntry entry;
+        entry.size = size;
+        entry.radius = radius;
+        entry.border = border;
+        entry.mask = rasterizeShape(size, radius, border);
+
+        QMutexLocker locker(&m_mtx);
+        for (auto &cached : m_entries) {
+            if (cached.size == size && cached.radius == radius && cached.border == border) return cached.mask;
+        }
+        m_entries.prepend(entry);
+        m_bytes += shapeMaskBytes(entry.mask);
+        while (m_entries.size() > 1 && m_bytes > sMaxShapeMaskBytes) {
+            m_bytes -= shapeMaskBytes(m_entries.last().mask);
+            m_entries.removeLast();
+        }
+        return entry.mask;
+    }
+
+    int ShapeMaskCache::count() {
+        QMutexLocker locker(&m_mtx);
+        return m_entries.size();
+    }
+
+    qint64 ShapeMaskCache::bytes() {
+        QMutexLocker locker(&m_mtx);
+        return m_bytes;
+    }
+
+    int ShapeMaskCache::hits() {
+        QMutexLocker locker(&m_mtx);
+        return m_hits;
+    }
+
+    int ShapeMaskCache::misses() {
+        QMutexLocker locker(&m_mtx);
+        return m_misses;
+    }
+} // namespace qtwrapper
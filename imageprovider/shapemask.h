@@ -0,0 +1,72 @@
+/**
+ * @file shapemask.h
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef __SHAPEMASK_H__
+#define __SHAPEMASK_H__
+
+#include <QImage>
+#include <QMutex>
+#include <QList>
+
+namespace qtwrapper
+{
+    /**
+     * @fn ShapeMask
+     * @brief Antialiased coverage of a rounded rect (Format_Alpha8) and of its border stroke,
+     * null border if the shape has none. A radius of half the side gives a circle.
+     */
+    typedef struct {
+        QImage coverage;
+        QImage border;
+    } ShapeMask;
+
+    /**
+     * @fn ShapeMaskCache
+     * @brief Shape masks keyed by (size, radius, border), shared by every item of the same shape:
+     * a grid of same sized avatars rasterizes its rounded rect once. The cache is bounded in bytes,
+     * the least recently used masks are dropped first.
+     */
+    class ShapeMaskCache
+    {
+    private:
+        typedef struct {
+            QSize size;
+            qreal radius;
+            qreal border;
+            ShapeMask mask;
+        } ShapeMaskEntry;
+
+        QMutex m_mtx;
+        /* Most recently used first */
+        QList<ShapeMaskEntry> m_entries;
+        qint64 m_bytes;
+        int m_hits;
+        int m_misses;
+
+        ShapeMaskCache();
+
+    public:
+        static ShapeMaskCache *instance();
+
+        /**
+         * @fn mask
+         * @brief Coverage of the rounded rect (0, 0, size) with this radius, and of a border of this width along it
+         */
+        ShapeMask mask(const QSize &size, qreal radius, qreal border);
+
+        int count();
+        /* Bytes of the cached masks, a mask still used by an item outlives its entry */
+        qint64 bytes();
+        int hits();
+        int misses();
+    };
+} // namespace qtwrapper
+#endif // __SHAPEMASK_H__
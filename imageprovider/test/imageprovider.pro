@@ -2,9 +2,27 @@ QT += quick core gui
 
 SOURCES += \
         ../imageprovider.cpp \
+        ../imagecache.cpp \
+        ../framestream.cpp \
+        ../imagepool.cpp \
+        ../imagemetrics.cpp \
+        ../compositekernel.cpp \
+        ../gradientregistry.cpp \
+        ../shapemask.cpp \
+        ../tilegrid.cpp \
+        ../../worker/QWorkerPool.cpp \
         main.cpp
 
 HEADERS += ../imageprovider.h \
+        ../imagecache.h \
+        ../framestream.h \
+        ../imagepool.h \
+        ../imagemetrics.h \
+        ../compositekernel.h \
+        ../gradientregistry.h \
+        ../shapemask.h \
+        ../tilegrid.h \
+        ../../worker/QWorkerPool.h \
         CallManager.h
 
 resources.files = main.qml
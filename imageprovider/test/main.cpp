@@ -2,53 +2,38 @@
 #include <QQmlApplicationEngine>
 #include "../imageprovider.h"
 #include <QDebug>
-#include <stdio.h>
-#include <string.h>
-#include <errno.h>
-#include <stdlib.h>
-#include <fcntl.h>
-#include <unistd.h>
 #include <QQmlContext>
 #include <QObject>
+
+using namespace qtwrapper;
+
 int main(int argc, char *argv[]) {
     QGuiApplication app(argc, argv);
     auto imageProvider = ImageProvider::instance();
-    // read file data into buffer
-    size_t size = 1024 * 1000;
-    char *buffer = new char[size];
 
     const char *images[] = {"image1.jpg", "image2.jpg", "image3.jpg", "image4.jpg", "image5.png"};
 
+    // decode the images on all cores while the qml engine is set up
+    QList<ImageSource> sources;
     for (int i = 0; i < 5; i++) {
-        qDebug() << "open Image " << images[i];
-        int fd = open(images[i], O_RDONLY);
-        if (fd == -1) {
-            perror("open");
-            continue;
-        }
-
-        int bytes_read = read(fd, buffer, size);
-        if (bytes_read == -1) {
-            perror("read");
-            close(fd);
-            continue;
-        }
-
-        qDebug() << "read bytes" << (int)bytes_read;
-        close(fd);
-
-        QByteArray arr(buffer, bytes_read);
-        QString imageStr = "data:image/;base64," + arr.toBase64();
-        std::string buf(buffer, bytes_read);
-        imageProvider->updateImage(images[i], buf.data(), buf.size());
+        ImageSource source;
+        source.id = images[i];
+        source.path = images[i];
+        sources.append(source);
     }
+    auto prefetch = imageProvider->prefetch(sources, 0, [](int completed, int total) {
+        qDebug() << "prefetch" << completed << "/" << total;
+    });
 
     qmlRegisterType<OpacityImage>("opacityimage", 1, 0, "OpacityImage");
+    qmlRegisterType<OpacityImageNode>("opacityimage", 1, 0, "OpacityImageNode");
 
     QQmlApplicationEngine engine;
     engine.addImageProvider("imageProvider", imageProvider);
 
     auto root = engine.rootContext();
+    // provider counters for qml: imageProvider.metrics()
+    root->setContextProperty("imageProvider", imageProvider);
 
     const QUrl url(u"qrc:/imageprovider/main.qml"_qs);
     QObject::connect(
@@ -58,6 +43,8 @@ int main(int argc, char *argv[]) {
                 QCoreApplication::exit(-1);
         },
         Qt::QueuedConnection);
+    prefetch->wait();
+    qDebug() << "loaded images" << prefetch->loaded() << "/" << prefetch->total();
     engine.load(url);
 
     return app.exec();
@@ -60,7 +60,7 @@ Window {
                     Column{
                         spacing: 10
                         anchors.fill: parent
-                        OpacityImage {
+                        OpacityImageNode {
                             id: img1
                             width: 300
                             height: 300
@@ -82,6 +82,7 @@ Window {
                                 radius: 10
                                 resizemode: OpacityImage.Fit
                                 xMirror: true
+                                asynchronous: true
                                 gradient: LinearGradient
                                 {
                                     x1: 0
@@ -0,0 +1,157 @@
+/**
+ * @file tilegrid.cpp
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "tilegrid.h"
+#include "imagepool.h"
+#include <algorithm>
+#include <string.h>
+
+namespace qtwrapper
+{
+    /* Side of a tile, a row of a 32 bit tile is 4 cache lines */
+    static const int sTileSize = 64;
+    /* Images from this many pixels on are tiled, below it tracking tiles costs more than it saves */
+    static const qint64 sTiledMinPixels = 512 * 512;
+
+    TileGrid::TileGrid() :
+        m_tileSize(0),
+        m_columns(0),
+        m_rows(0),
+        m_dirtyCount(0) {
+    }
+
+    int TileGrid::tileSizeFor(const QSize &size) {
+        if (static_cast<qint64>(size.width()) * size.height() >= sTiledMinPixels) return sTileSize;
+        return qMax(1, qMax(size.width(), size.height()));
+    }
+
+    void TileGrid::reset(const QSize &size) {
+        m_size = size;
+        m_tileSize = tileSizeFor(size);
+        m_columns = size.isEmpty() ? 0 : (size.width() + m_tileSize - 1) / m_tileSize;
+        m_rows = size.isEmpty() ? 0 : (size.height() + m_tileSize - 1) / m_tileSize;
+        m_dirty.assign(m_columns * m_rows, 0);
+        m_dirtyCount = 0;
+    }
+
+    QRect TileGrid::tileRect(int index) const {
+        QRect rect((index % m_columns) * m_tileSize, (index / m_columns) * m_tileSize, m_tileSize, m_tileSize);
+        return rect.intersected(QRect(QPoint(0, 0), m_size));
+    }
+
+    void TileGrid::mark(int index) {
+        if (m_dirty[index]) return;
+        m_dirty[index] = 1;
+        m_dirtyCount++;
+    }
+
+    void TileGrid::markAll() {
+        std::fill(m_dirty.begin(), m_dirty.end(), 1);
+        m_dirtyCount = count();
+    }
+
+    QRect TileGrid::dirtyBounds() const {
+        QRect bounds;
+        if (!m_dirtyCount) return bounds;
+        for (int i = 0; i < count(); i++) {
+            if (m_dirty[i]) bounds = bounds.united(tileRect(i));
+        }
+        return bounds;
+    }
+
+    void TileGrid::markChanged(const QImage &a, const QImage &b) {
+        if (a.cacheKey() == b.cacheKey() && !a.isNull()) return;
+        if (a.isNull() || b.isNull() || a.size() != b.size() || a.format() != b.format() || count() <= 1) {
+            markAll();
+            return;
+        }
+
+        const int bytesPerPixel = a.depth() / 8;
+        const QRect bounds = QRect(QPoint(0, 0), a.size());
+        for (int i = 0; i < count(); i++) {
+            if (m_dirty[i]) continue;
+            const QRect rect = tileRect(i).intersected(bounds);
+            for (int y = rect.top(); y <= rect.bottom(); y++) {
+                const uchar *pa = a.constScanLine(y) + rect.left() * bytesPerPixel;
+                const uchar *pb = b.constScanLine(y) + rect.left() * bytesPerPixel;
+                if (memcmp(pa, pb, rect.width() * bytesPerPixel) != 0) {
+                    mark(i);
+                    break;
+                }
+            }
+        }
+    }
+
+    void TileGrid::markNonZero(const QImage &alpha, const QRect &exclude) {
+        if (alpha.isNull()) return;
+
+        const QRect bounds = QRect(QPoint(0, 0), alpha.size());
+        for (int i = 0; i < count(); i++) {
+            if (m_dirty[i]) continue;
+            const QRect rect = tileRect(i).intersected(bounds);
+            for (int y = rect.top(); y <= rect.bottom() && !m_dirty[i]; y++) {
+                const uchar *line = alpha.constScanLine(y);
+                for (int x = rect.left(); x <= rect.right(); x++) {
+                    if (line[x] && !exclude.contains(x, y)) {
+                        mark(i);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    void TileGrid::merge(const TileGrid &other) {
+        if (other.m_size != m_size || other.m_tileSize != m_tileSize) {
+            markAll();
+            return;
+        }
+        for (int i = 0; i < count(); i++) {
+            if (other.m_dirty[i]) mark(i);
+        }
+    }
+
+    TiledBuffer::TiledBuffer() :
+        m_front(0) {
+    }
+
+    QImage &TiledBuffer::back(const QSize &size, QImage::Format format, TileGrid &dirty) {
+        QImage &back = m_buffers[1 - m_front];
+        const QImage &front = m_buffers[m_front];
+        /* A new back buffer has none of the front, every tile the caller does not write is copied */
+        bool copyAll = false;
+        if (back.isNull() || back.size() != size || back.format() != format) {
+            back = ImageBufferPool::instance()->allocate(size, format);
+            copyAll = true;
+        }
+        if (back.isNull()) return back;
+        if (front.isNull() || front.size() != size || front.format() != format || m_frontChanges.size() != size) {
+            dirty.markAll();
+            return back;
+        }
+
+        const int bytesPerPixel = back.depth() / 8;
+        for (int i = 0; i < dirty.count(); i++) {
+            if (dirty.isDirty(i) || (!copyAll && !m_frontChanges.isDirty(i))) continue;
+            const QRect rect = dirty.tileRect(i);
+            for (int y = rect.top(); y <= rect.bottom(); y++) {
+                memcpy(back.scanLine(y) + rect.left() * bytesPerPixel, front.constScanLine(y) + rect.left() * bytesPerPixel,
+                       rect.width() * bytesPerPixel);
+            }
+        }
+        return back;
+    }
+
+    void TiledBuffer::swap(const TileGrid &dirty) {
+        m_front = 1 - m_front;
+        m_frontChanges = dirty;
+    }
+} // namespace qtwrapper
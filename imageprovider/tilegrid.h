@@ -0,0 +1,133 @@
+/**
+ * @file tilegrid.h
+ * @author greatboxs (greatboxs@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef __TILEGRID_H__
+#define __TILEGRID_H__
+
+#include <QImage>
+#include <QRect>
+#include <vector>
+
+namespace qtwrapper
+{
+    /**
+     * @fn TileGrid
+     * @brief Dirty flags of the tiles covering an image. Large images are cut in square tiles so a change
+     * only recomputes the tiles it touches, a small image is a single tile.
+     */
+    class TileGrid
+    {
+    private:
+        QSize m_size;
+        int m_tileSize;
+        int m_columns;
+        int m_rows;
+        std::vector<char> m_dirty;
+        int m_dirtyCount;
+
+    public:
+        TileGrid();
+
+        /**
+         * @fn tileSizeFor
+         * @brief Side of the tiles of an image of this size
+         */
+        static int tileSizeFor(const QSize &size);
+
+        /**
+         * @fn reset
+         * @brief Tiles of an image of this size, all clean
+         */
+        void reset(const QSize &size);
+
+        const QSize &size() const { return m_size; }
+        int count() const { return m_columns * m_rows; }
+        int dirtyCount() const { return m_dirtyCount; }
+        bool isDirty(int index) const { return m_dirty[index] != 0; }
+        QRect tileRect(int index) const;
+
+        void mark(int index);
+        void markAll();
+
+        /**
+         * @fn dirtyBounds
+         * @brief Smallest rect holding every dirty tile, null if none is dirty
+         */
+        QRect dirtyBounds() const;
+
+        /**
+         * @fn markChanged
+         * @brief Mark the tiles where the pixels of a and b differ, all of them if the images do not have
+         * the same size and format or if the grid is a single tile
+         */
+        void markChanged(const QImage &a, const QImage &b);
+
+        /**
+         * @fn markNonZero
+         * @brief Mark the tiles with a non zero pixel of an Alpha8 image out of the "exclude" rect
+         */
+        void markNonZero(const QImage &alpha, const QRect &exclude);
+
+        /**
+         * @fn merge
+         * @brief Mark the dirty tiles of another grid, all of them if its layout is different
+         */
+        void merge(const TileGrid &other);
+    };
+
+    /**
+     * @fn TileChanges
+     * @brief Tiles changed between two versions (cacheKey) of an image updated in place
+     */
+    typedef struct {
+        qint64 fromKey;
+        qint64 toKey;
+        TileGrid tiles;
+    } TileChanges;
+
+    /**
+     * @fn TiledBuffer
+     * @brief Front and back pool buffers of an image updated by tiles. The front is the last complete image and is only read;
+     * a new version is written in the back, which first gets the tiles the front changed and the new version does not
+     * overwrite, then the buffers swap. An update of a few tiles copies and writes a few tiles, and the shown image is
+     * never written.
+     */
+    class TiledBuffer
+    {
+    private:
+        QImage m_buffers[2];
+        int m_front;
+        /* Tiles where the front differs from the back */
+        TileGrid m_frontChanges;
+
+    public:
+        TiledBuffer();
+
+        const QImage &front() const { return m_buffers[m_front]; }
+
+        /**
+         * @fn back
+         * @brief Back buffer holding the front outside the "dirty" tiles, which the caller writes before swap.
+         * A back buffer of another size or format is allocated again, all the tiles are then marked dirty
+         * if the front cannot fill it.
+         *
+         * @return QImage&  null if the buffer cannot be allocated
+         */
+        QImage &back(const QSize &size, QImage::Format format, TileGrid &dirty);
+
+        /**
+         * @fn swap
+         * @brief The back becomes the front, "dirty" are the tiles written since back()
+         */
+        void swap(const TileGrid &dirty);
+    };
+} // namespace qtwrapper
+#endif // __TILEGRID_H__
@@ -0,0 +1,141 @@
+#include "QWorkerPool.h"
+#include <QRunnable>
+#include <exception>
+
+namespace qtwrapper
+{
+    class QWorkerRunnable : public QRunnable
+    {
+    private:
+        QWorkerTaskHandler m_fnc;
+        QWorkerTaskPtr m_task;
+
+    public:
+        explicit QWorkerRunnable(QWorkerTaskHandler fnc, QWorkerTaskPtr task = NULL) :
+            m_fnc(std::move(fnc)),
+            m_task(std::move(task)) {
+            setAutoDelete(true);
+        }
+
+        ~QWorkerRunnable() {
+            /* Dropped from the queue without running (pool cleared) */
+            if (m_task) {
+                QMutexLocker locker(&m_task->m_stMtx);
+                if (m_task->m_s32State == TASK_QUEUED) {
+                    m_task->m_s32State = TASK_CANCELED;
+                    m_task->m_poRunnable = NULL;
+                    m_task->m_stCond.wakeAll();
+                }
+            }
+        }
+
+        void run() override {
+            if (m_task) {
+                QMutexLocker locker(&m_task->m_stMtx);
+                if (m_task->m_s32State != TASK_QUEUED) return;
+                m_task->m_s32State = TASK_RUNNING;
+                m_task->m_poRunnable = NULL;
+            }
+
+            try {
+                m_fnc();
+            } catch (std::exception &ex) {}
+
+            if (m_task) {
+                QMutexLocker locker(&m_task->m_stMtx);
+                m_task->m_s32State = TASK_DONE;
+                m_task->m_stCond.wakeAll();
+            }
+        }
+    };
+
+    QWorkerTask::QWorkerTask(QThreadPool *pool) :
+        m_poPool(pool),
+        m_poRunnable(NULL),
+        m_s32State(TASK_QUEUED) {
+    }
+
+    int QWorkerTask::State() {
+        QMutexLocker locker(&m_stMtx);
+        return m_s32State;
+    }
+
+    int QWorkerTask::Cancel() {
+        QRunnable *runnable = NULL;
+        {
+            QMutexLocker locker(&m_stMtx);
+            if (m_s32State != TASK_QUEUED) return static_cast<int>(m_s32State == TASK_CANCELED);
+
+            /* If the runnable was already dequeued it will see the state and return */
+            if (m_poRunnable && m_poPool->tryTake(m_poRunnable)) runnable = m_poRunnable;
+            m_poRunnable = NULL;
+            m_s32State = TASK_CANCELED;
+            m_stCond.wakeAll();
+        }
+        delete runnable;
+        return 1;
+    }
+
+    int QWorkerTask::Wait(int msecs) {
+        QMutexLocker locker(&m_stMtx);
+        while (m_s32State == TASK_QUEUED || m_s32State == TASK_RUNNING) {
+            if (msecs < 0) {
+                m_stCond.wait(&m_stMtx);
+            } else if (!m_stCond.wait(&m_stMtx, msecs)) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    int QWorkerTask::SetPriority(int priority) {
+        QMutexLocker locker(&m_stMtx);
+        if (m_s32State != TASK_QUEUED || !m_poRunnable) return 0;
+
+        /* Requeue the runnable, run() blocks on the task lock until it is back in the queue */
+        if (!m_poPool->tryTake(m_poRunnable)) return 0;
+        m_poPool->start(m_poRunnable, priority);
+        return 1;
+    }
+
+    QWorkerPool::QWorkerPool(const char *cPoolName, int maxThreads) :
+        m_strName(QString(cPoolName)) {
+        m_stPool.setObjectName(m_strName);
+        if (maxThreads > 0) m_stPool.setMaxThreadCount(maxThreads);
+    }
+
+    QWorkerPool::~QWorkerPool() {
+        m_stPool.clear();
+        m_stPool.waitForDone();
+    }
+
+    int QWorkerPool::MaxThreads() const {
+        return m_stPool.maxThreadCount();
+    }
+
+    void QWorkerPool::SetMaxThreads(int maxThreads) {
+        if (maxThreads > 0) m_stPool.setMaxThreadCount(maxThreads);
+    }
+
+    int QWorkerPool::Submit(QWorkerTaskHandler fnc, int priority) {
+        if (!fnc) return -1;
+        m_stPool.start(new QWorkerRunnable(std::move(fnc)), priority);
+        return 0;
+    }
+
+    QWorkerTaskPtr QWorkerPool::Schedule(QWorkerTaskHandler fnc, int priority) {
+        if (!fnc) return NULL;
+        auto task = std::make_shared<QWorkerTask>(&m_stPool);
+        auto runnable = new QWorkerRunnable(std::move(fnc), task);
+
+        /* Hold the task lock so Cancel can not race with the runnable being queued */
+        QMutexLocker locker(&task->m_stMtx);
+        task->m_poRunnable = runnable;
+        m_stPool.start(runnable, priority);
+        return task;
+    }
+
+    int QWorkerPool::WaitForDone(int msecs) {
+        return m_stPool.waitForDone(msecs) == true;
+    }
+} // namespace qtwrapper
@@ -0,0 +1,124 @@
+#ifndef __QWORKERPOOL_H__
+#define __QWORKERPOOL_H__
+
+#include <QThreadPool>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QString>
+#include <functional>
+#include <memory>
+
+namespace qtwrapper
+{
+    using QWorkerTaskHandler = std::function<void()>;
+
+    typedef enum {
+        TASK_QUEUED,
+        TASK_RUNNING,
+        TASK_DONE,
+        TASK_CANCELED,
+    } eWorkerTaskState;
+
+    /**
+     * @fn QWorkerTask
+     * @brief Handle of a task scheduled on a QWorkerPool.
+     * The handle is only valid while the pool which created it is alive.
+     */
+    class QWorkerTask
+    {
+        friend class QWorkerPool;
+        friend class QWorkerRunnable;
+
+    private:
+        QMutex m_stMtx;
+        QWaitCondition m_stCond;
+        QThreadPool *m_poPool;
+        QRunnable *m_poRunnable;
+        int32_t m_s32State;
+
+    public:
+        explicit QWorkerTask(QThreadPool *pool);
+
+        int State();
+
+        /**
+         * @fn Cancel
+         * @brief Remove the task from the queue if it has not started yet
+         *
+         * @return int  1 if the task will never run, 0 if it is running or already done
+         */
+        int Cancel();
+
+        /**
+         * @fn SetPriority
+         * @brief Move the task in the queue according to a new priority if it has not started yet
+         *
+         * @param priority  Higher value is started first
+         * @return int  1 if the task was requeued, 0 if it is running, done or canceled
+         */
+        int SetPriority(int priority);
+
+        /**
+         * @fn Wait
+         * @brief Wait until the task is done or canceled
+         *
+         * @param msecs     Timeout in milliseconds, -1 to wait forever
+         * @return int      1 if the task is done or canceled, 0 on timeout
+         */
+        int Wait(int msecs = -1);
+    };
+
+    using QWorkerTaskPtr = std::shared_ptr<QWorkerTask>;
+
+    /**
+     * @fn QWorkerPool
+     * @brief A pool of worker threads for short one-shot jobs (image decode, scaling, ...).
+     * Queued tasks with a higher priority are started first.
+     */
+    class QWorkerPool
+    {
+    private:
+        QThreadPool m_stPool;
+        QString m_strName;
+
+        QWorkerPool(const QWorkerPool &) = delete;
+        QWorkerPool &operator=(const QWorkerPool &) = delete;
+
+    public:
+        explicit QWorkerPool(const char *cPoolName, int maxThreads = -1);
+        ~QWorkerPool();
+
+        int MaxThreads() const;
+        void SetMaxThreads(int maxThreads);
+
+        /**
+         * @fn Submit
+         * @brief Queue a task to be run by one of the pool threads
+         *
+         * @param fnc       Task to run
+         * @param priority  Higher value is started first
+         * @return int      0 on success, -1 if fnc is empty
+         */
+        int Submit(QWorkerTaskHandler fnc, int priority = 0);
+
+        /**
+         * @fn Schedule
+         * @brief Same as Submit but returns a handle to cancel or wait for the task
+         *
+         * @param fnc       Task to run
+         * @param priority  Higher value is started first
+         * @return QWorkerTaskPtr   NULL if fnc is empty
+         */
+        QWorkerTaskPtr Schedule(QWorkerTaskHandler fnc, int priority = 0);
+
+        /**
+         * @fn WaitForDone
+         * @brief Wait until every queued task has finished
+         *
+         * @param msecs     Timeout in milliseconds, -1 to wait forever
+         * @return int      1 if all tasks have finished, 0 on timeout
+         */
+        int WaitForDone(int msecs = -1);
+    };
+};     // namespace qtwrapper
+#endif // __QWORKERPOOL_H__